@@ -13,21 +13,12 @@
 /* Define to 1 if you have the <dmalloc.h> header file */
 /* #undef HAVE_DMALLOC_H */
 
-/* define if the compiler has ext/hash_map */
-/* #undef HAVE_EXT_HASH_MAP */
-
-/* define if the compiler supports __gnu_cxx::hash_map */
-#define HAVE_GNUCXX_HASHMAP /**/
-
 /* Define to 1 if you have the <inttypes.h> header file. */
 #define HAVE_INTTYPES_H 1
 
 /* Define to 1 if you have the `dmallocthcxx' library (-ldmallocthcxx). */
 /* #undef HAVE_LIBDMALLOCTHCXX */
 
-/* Define to 1 if you have the `fcgi' library (-lfcgi). */
-#define HAVE_LIBFCGI 1
-
 /* Define to 1 if you have the <memory.h> header file. */
 #define HAVE_MEMORY_H 1
 
@@ -43,9 +34,6 @@
 /* Define to 1 if you have the <stdlib.h> header file. */
 #define HAVE_STDLIB_H 1
 
-/* define if the compiler supports std::hash_map */
-/* #undef HAVE_STLPORT_HASHMAP */
-
 /* Define to 1 if you have the <strings.h> header file. */
 #define HAVE_STRINGS_H 1
 
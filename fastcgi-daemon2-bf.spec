@@ -12,7 +12,6 @@ BuildRequires:	boost-devel
 BuildRequires:	automake, autoconf, libtool
 BuildRequires:	pkgconfig
 BuildRequires:  libxml2-devel
-BuildRequires:  fcgi-devel
 BuildRequires:  cppunit-devel
 BuildRequires:  openssl-devel
 
@@ -0,0 +1,63 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <boost/utility.hpp>
+
+#include <cstddef>
+#include <cstring>
+
+namespace fastcgi {
+
+/**
+ * Search primitives over contiguous memory that Range, the DataBuffer
+ * implementations, the parsers and the url codecs are built on. A substring is
+ * looked for by its first and last bytes 16 (SSE2) or 32 (AVX2) positions at a
+ * time and only the candidates are compared in full. Case insensitive
+ * comparison folds ASCII letters as many bytes at a time, the url scanners
+ * classify as many bytes at a time. This is the one place that picks the
+ * instruction set: the widest the CPU supports is picked on first use, other
+ * targets get memmem and plain loops.
+ */
+class ByteSearch : private boost::noncopyable {
+public:
+	// end when there is no such byte
+	static const char* find(const char *begin, const char *end, char ch);
+	static const char* find(const char *begin, const char *end, const char *str, std::size_t size);
+
+	// ASCII letters compare regardless of their case
+	static bool equalsCI(const char *lhs, const char *rhs, std::size_t size);
+
+	// first '%' or '+', end when there is none
+	static const char* findEscape(const char *begin, const char *end);
+	// first byte urlencode escapes and the number of such bytes
+	static const char* findUnsafe(const char *begin, const char *end);
+	static std::size_t countUnsafe(const char *begin, const char *end);
+};
+
+inline const char*
+ByteSearch::find(const char *begin, const char *end, char ch) {
+	if (begin == end) {
+		return end;
+	}
+	const void *found = memchr(begin, ch, end - begin);
+	return found ? static_cast<const char*>(found) : end;
+}
+
+} // namespace fastcgi
@@ -0,0 +1,64 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include "fastcgi2/data_buffer.h"
+#include "details/data_buffer_impl.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <string>
+
+namespace fastcgi {
+
+/**
+ * Buffer made of fixed size blocks, every block is a segment of its own.
+ * Growing the buffer adds blocks and never moves the data already there.
+ * Blocks come from a pool shared by all threads, since a buffer is often
+ * released by another thread than the one that filled it, and go back there
+ * with the last copy of the buffer.
+ */
+class ChunkedBuffer : public DataBufferImpl {
+public:
+	explicit ChunkedBuffer(boost::uint64_t size);
+	virtual ~ChunkedBuffer();
+	virtual boost::uint64_t read(boost::uint64_t pos, char *data, boost::uint64_t len);
+	virtual boost::uint64_t write(boost::uint64_t pos, const char *data, boost::uint64_t len);
+	virtual char at(boost::uint64_t pos);
+	virtual boost::uint64_t find(boost::uint64_t begin, boost::uint64_t end, const char* buf, boost::uint64_t len);
+	virtual std::pair<boost::uint64_t, boost::uint64_t> trim(boost::uint64_t begin, boost::uint64_t end) const;
+	virtual std::pair<char*, boost::uint64_t> chunk(boost::uint64_t pos) const;
+	virtual std::pair<boost::uint64_t, boost::uint64_t> segment(boost::uint64_t pos) const;
+	virtual boost::uint64_t size() const;
+	virtual void resize(boost::uint64_t size);
+	virtual const std::string& filename() const;
+	virtual DataBufferImpl* getCopy() const;
+
+	static const std::size_t BLOCK_SIZE = 65536;
+
+private:
+	bool equals(boost::uint64_t pos, const char *buf, boost::uint64_t len) const;
+
+private:
+	class Blocks;
+	boost::shared_ptr<Blocks> blocks_;
+};
+
+} // namespace fastcgi
@@ -0,0 +1,343 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace fastcgi {
+
+namespace ci {
+
+static const boost::uint64_t ONES = 0x0101010101010101ULL;
+static const boost::uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+static const boost::uint64_t SECRET0 = 0xa0761d6478bd642fULL;
+static const boost::uint64_t SECRET1 = 0xe7037ed1a0b428dbULL;
+static const boost::uint64_t SECRET2 = 0x8ebc6af09c88c6e3ULL;
+
+// ASCII upper case letters of the eight bytes to lower case, other bytes as is
+inline boost::uint64_t
+foldWord(boost::uint64_t word) {
+	boost::uint64_t low = word & ~HIGH_BITS;
+	boost::uint64_t upper = (low + (0x80 - 'A') * ONES) & ~(low + (0x80 - 'Z' - 1) * ONES) & ~word & HIGH_BITS;
+	return word | (upper >> 2);
+}
+
+inline boost::uint64_t
+loadWord(const char *str, std::size_t size) {
+	boost::uint64_t word = 0;
+	memcpy(&word, str, size);
+	return word;
+}
+
+inline boost::uint64_t
+mix(boost::uint64_t a, boost::uint64_t b) {
+#ifdef __SIZEOF_INT128__
+	unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+	return static_cast<boost::uint64_t>(r) ^ static_cast<boost::uint64_t>(r >> 64);
+#else
+	boost::uint64_t r = a * b;
+	return r ^ (r >> 32) ^ (b * SECRET2);
+#endif
+}
+
+} // namespace ci
+
+/**
+ * Case insensitive hash of a string. The string is folded to lower case eight
+ * bytes at a time and the words are mixed with wide multiplications in the way
+ * wyhash does it, so a header name takes a couple of multiplications.
+ */
+inline boost::uint64_t
+ciHash(const char *str, std::size_t size) {
+	boost::uint64_t hash = ci::SECRET0 ^ size;
+	for (; size > 8; str += 8, size -= 8) {
+		hash = ci::mix(ci::foldWord(ci::loadWord(str, 8)) ^ ci::SECRET1, hash ^ ci::SECRET0);
+	}
+	hash = ci::mix(ci::foldWord(ci::loadWord(str, size)) ^ ci::SECRET1, hash ^ ci::SECRET2);
+	return ci::mix(hash, ci::SECRET0);
+}
+
+inline bool
+ciEqual(const char *str, const char *target, std::size_t size) {
+	for (; size >= 8; str += 8, target += 8, size -= 8) {
+		if (ci::foldWord(ci::loadWord(str, 8)) != ci::foldWord(ci::loadWord(target, 8))) {
+			return false;
+		}
+	}
+	return ci::foldWord(ci::loadWord(str, size)) == ci::foldWord(ci::loadWord(target, size));
+}
+
+/**
+ * Hash map with case insensitive std::string keys. Entries are kept in one flat
+ * array and found by open addressing: every slot has a control byte holding
+ * seven bits of the hash of its key or a mark of an empty slot, and the control
+ * bytes are probed sixteen at a time (with one SSE2 comparison where available),
+ * so a lookup mostly compares one key. Entries are not removed one by one,
+ * clear() empties the map and keeps its memory for the next use.
+ */
+template<typename Value>
+class CIHashMap {
+public:
+	typedef std::string key_type;
+	typedef Value mapped_type;
+	typedef std::pair<std::string, Value> value_type;
+
+	template<typename MapType, typename ValueType>
+	class Iterator : public std::iterator<std::forward_iterator_tag, ValueType> {
+	public:
+		Iterator() : map_(NULL), index_(0) {
+		}
+
+		// iterator converts to const_iterator only
+		template<typename OtherMap, typename OtherValue>
+		Iterator(const Iterator<OtherMap, OtherValue> &other,
+			typename std::enable_if<std::is_convertible<OtherMap*, MapType*>::value>::type* = NULL) :
+			map_(other.map_), index_(other.index_)
+		{}
+
+		ValueType& operator * () const {
+			return map_->slots_[index_];
+		}
+
+		ValueType* operator -> () const {
+			return &map_->slots_[index_];
+		}
+
+		Iterator& operator ++ () {
+			index_ = map_->next(index_ + 1);
+			return *this;
+		}
+
+		Iterator operator ++ (int) {
+			Iterator result = *this;
+			++*this;
+			return result;
+		}
+
+		template<typename OtherMap, typename OtherValue>
+		bool operator == (const Iterator<OtherMap, OtherValue> &other) const {
+			return index_ == other.index_;
+		}
+
+		template<typename OtherMap, typename OtherValue>
+		bool operator != (const Iterator<OtherMap, OtherValue> &other) const {
+			return index_ != other.index_;
+		}
+
+	private:
+		template<typename, typename> friend class Iterator;
+		friend class CIHashMap;
+
+		Iterator(MapType *map, std::size_t index) : map_(map), index_(index) {
+		}
+
+		MapType *map_;
+		std::size_t index_;
+	};
+
+	typedef Iterator<CIHashMap, value_type> iterator;
+	typedef Iterator<const CIHashMap, const value_type> const_iterator;
+
+	CIHashMap() : size_(0) {
+	}
+
+	std::size_t size() const {
+		return size_;
+	}
+
+	bool empty() const {
+		return 0 == size_;
+	}
+
+	iterator begin() {
+		return iterator(this, next(0));
+	}
+
+	iterator end() {
+		return iterator(this, control_.size());
+	}
+
+	const_iterator begin() const {
+		return const_iterator(this, next(0));
+	}
+
+	const_iterator end() const {
+		return const_iterator(this, control_.size());
+	}
+
+	iterator find(const std::string &key) {
+		return iterator(this, lookup(key, ciHash(key.data(), key.size())));
+	}
+
+	const_iterator find(const std::string &key) const {
+		return const_iterator(this, lookup(key, ciHash(key.data(), key.size())));
+	}
+
+	// the key keeps the case it was inserted with first
+	std::pair<iterator, bool> insert(const value_type &value) {
+		boost::uint64_t hash = ciHash(value.first.data(), value.first.size());
+		std::size_t index = lookup(value.first, hash);
+		if (index != control_.size()) {
+			return std::make_pair(iterator(this, index), false);
+		}
+		index = place(hash);
+		slots_[index] = value;
+		return std::make_pair(iterator(this, index), true);
+	}
+
+	Value& operator [] (const std::string &key) {
+		boost::uint64_t hash = ciHash(key.data(), key.size());
+		std::size_t index = lookup(key, hash);
+		if (index == control_.size()) {
+			index = place(hash);
+			slots_[index].first = key;
+		}
+		return slots_[index].second;
+	}
+
+	void clear() {
+		if (0 == size_) {
+			return;
+		}
+		for (std::size_t i = 0, count = control_.size(); i < count; ++i) {
+			if (control_[i] != EMPTY) {
+				control_[i] = EMPTY;
+				slots_[i].first.clear();
+				slots_[i].second = Value();
+			}
+		}
+		size_ = 0;
+	}
+
+	void swap(CIHashMap &other) {
+		control_.swap(other.control_);
+		slots_.swap(other.slots_);
+		std::swap(size_, other.size_);
+	}
+
+private:
+	static const signed char EMPTY = -128;
+	static const std::size_t GROUP_SIZE = 16;
+
+	static signed char tag(boost::uint64_t hash) {
+		return static_cast<signed char>(hash & 0x7f);
+	}
+
+	// bit i is set when control byte i of the group equals value
+	static unsigned int match(const signed char *group, signed char value) {
+#ifdef __SSE2__
+		__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value)));
+#else
+		unsigned int mask = 0;
+		for (std::size_t i = 0; i < GROUP_SIZE; ++i) {
+			mask |= static_cast<unsigned int>(group[i] == value) << i;
+		}
+		return mask;
+#endif
+	}
+
+	std::size_t groups() const {
+		return control_.size() / GROUP_SIZE;
+	}
+
+	std::size_t lookup(const std::string &key, boost::uint64_t hash) const {
+		std::size_t count = groups();
+		if (0 == count) {
+			return 0;
+		}
+		std::size_t group = (hash >> 7) & (count - 1);
+		for (std::size_t step = 1; ; ++step) {
+			const signed char *control = &control_[group * GROUP_SIZE];
+			for (unsigned int mask = match(control, tag(hash)); mask; mask &= mask - 1) {
+				std::size_t index = group * GROUP_SIZE + __builtin_ctz(mask);
+				const std::string &name = slots_[index].first;
+				if (name.size() == key.size() && ciEqual(name.data(), key.data(), key.size())) {
+					return index;
+				}
+			}
+			if (match(control, EMPTY)) {
+				return control_.size();
+			}
+			group = (group + step) & (count - 1);
+		}
+	}
+
+	// takes an empty slot for a key which is not in the map
+	std::size_t place(boost::uint64_t hash) {
+		if ((size_ + 1) * 8 > control_.size() * 7) {
+			rehash(control_.empty() ? GROUP_SIZE : control_.size() * 2);
+		}
+		std::size_t count = groups();
+		std::size_t group = (hash >> 7) & (count - 1);
+		for (std::size_t step = 1; ; ++step) {
+			unsigned int mask = match(&control_[group * GROUP_SIZE], EMPTY);
+			if (mask) {
+				std::size_t index = group * GROUP_SIZE + __builtin_ctz(mask);
+				control_[index] = tag(hash);
+				++size_;
+				return index;
+			}
+			group = (group + step) & (count - 1);
+		}
+	}
+
+	void rehash(std::size_t capacity) {
+		std::vector<signed char> control(capacity, EMPTY);
+		std::vector<value_type> slots(capacity);
+		control_.swap(control);
+		slots_.swap(slots);
+		size_ = 0;
+		for (std::size_t i = 0, count = control.size(); i < count; ++i) {
+			if (control[i] != EMPTY) {
+				value_type &value = slots[i];
+				std::size_t index = place(ciHash(value.first.data(), value.first.size()));
+				slots_[index].first.swap(value.first);
+				std::swap(slots_[index].second, value.second);
+			}
+		}
+	}
+
+	std::size_t next(std::size_t index) const {
+		while (index < control_.size() && EMPTY == control_[index]) {
+			++index;
+		}
+		return index;
+	}
+
+private:
+	std::vector<signed char> control_;
+	std::vector<value_type> slots_;
+	std::size_t size_;
+};
+
+} // namespace fastcgi
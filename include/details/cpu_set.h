@@ -0,0 +1,53 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <sched.h>
+
+#include <string>
+
+namespace fastcgi {
+
+/**
+ * Set of CPUs a thread may run on. Lists use the kernel cpulist format,
+ * e.g. "0-3,8,10-11".
+ */
+class CpuSet {
+public:
+	CpuSet();
+
+	static CpuSet parse(const std::string &list);
+	static CpuSet numaNode(unsigned int node);
+
+	bool empty() const;
+	unsigned int count() const;
+
+	void merge(const CpuSet &other);
+	void intersect(const CpuSet &other);
+
+	// pins the calling thread, throws if the kernel refuses the set
+	void apply() const;
+
+	std::string toString() const;
+
+private:
+	cpu_set_t set_;
+};
+
+} // namespace fastcgi
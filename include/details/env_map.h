@@ -0,0 +1,119 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <boost/cstdint.hpp>
+#include <boost/utility.hpp>
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "fastcgi2/arena.h"
+
+#include "details/range.h"
+
+namespace fastcgi {
+
+/**
+ * Name-value table of a request environment. Names and values are copied into
+ * a buffer shared by all tables of the request and entries refer to them by
+ * offsets, so filling a table does not allocate once the buffer and the entry
+ * array have grown to the request size. A value becomes a std::string only when
+ * it is asked for by reference, the string then lives until clear(). The buffer
+ * and the entries come from the request arena.
+ *
+ * Well known CGI names are resolved with a perfect hash when they are added and
+ * looked up by index afterwards. Other names go to an open addressing index.
+ */
+class EnvMap : private boost::noncopyable {
+public:
+	enum Conversion { AS_IS, HEADER_NAME, URLDECODE };
+	typedef std::vector<char, ArenaAllocator<char> > Buffer;
+
+	// header names are in the form HEADER_NAME conversion gives them
+	enum Key {
+		SERVER_PORT, SERVER_ADDR, PATH_INFO, PATH_TRANSLATED, SCRIPT_NAME, SCRIPT_FILENAME, DOCUMENT_ROOT,
+		REMOTE_USER, REMOTE_ADDR, QUERY_STRING, REQUEST_METHOD, REQUEST_ID, HTTPS,
+		HOST, CONTENT_TYPE, CONTENT_LENGTH,
+		KEYS_COUNT
+	};
+
+	EnvMap(Buffer &buffer, bool ignoreCase);
+
+	// a value added under an existing name replaces the old one
+	void add(const Range &key, const Range &value);
+	void add(const Range &key, Conversion keyConversion, const Range &value, Conversion valueConversion);
+
+	bool has(const std::string &key) const;
+	const std::string& get(const std::string &key) const;
+
+	bool has(Key key) const;
+	const std::string& get(Key key) const;
+	void keys(std::vector<std::string> &v) const;
+
+	std::size_t size() const;
+	Range key(std::size_t index) const;
+	Range value(std::size_t index) const;
+
+	void reserve(std::size_t size);
+
+	// also gives the entries back, the arena may be reset after it
+	void clear();
+
+private:
+	struct Entry {
+		std::size_t keyOffset, keySize;
+		std::size_t valueOffset, valueSize;
+		boost::uint64_t hash;
+		mutable std::size_t string;
+	};
+
+	std::size_t copy(const Range &range, Conversion conversion);
+	const std::string& string(std::size_t index) const;
+
+	Key known(const char *key, std::size_t size, boost::uint64_t hash) const;
+	std::size_t find(const char *key, std::size_t size) const;
+	std::size_t findUnknown(const char *key, std::size_t size, boost::uint64_t hash) const;
+	void insertUnknown(std::size_t index);
+	void rehash(std::size_t capacity);
+	bool equal(const Entry &entry, const char *key, std::size_t size) const;
+
+private:
+	static const std::size_t NPOS = static_cast<std::size_t>(-1);
+
+	typedef std::vector<Entry, ArenaAllocator<Entry> > EntryVector;
+	typedef std::vector<std::size_t, ArenaAllocator<std::size_t> > IndexVector;
+
+	Buffer &buffer_;
+	bool ignoreCase_;
+	EntryVector entries_;
+
+	// entry indexes of the well known names and slots of the others holding entry index + 1
+	std::size_t known_[KEYS_COUNT];
+	IndexVector unknown_;
+
+	mutable std::mutex mutex_;
+	mutable std::deque<std::string> strings_;
+	mutable std::size_t stringsUsed_;
+};
+
+} // namespace fastcgi
@@ -46,38 +46,4 @@ struct RangeCILess : public std::binary_function<const Range&, const Range&, boo
 	}
 };
 
-#if defined(HAVE_GNUCXX_HASHMAP) || defined(HAVE_EXT_HASH_MAP) || defined(HAVE_STLPORT_HASHMAP)
-
-struct StringCIHash : public std::unary_function<const std::string&, boost::uint32_t>
-{
-	boost::uint32_t operator () (const std::string &str) const {
-		boost::uint32_t value = 0;
-		for (std::string::const_iterator i = str.begin(), end = str.end(); i != end; ++i) {
-			value += 5 * tolower(*i);
-		}
-		return value;
-	}
-};
-
-struct StringCIEqual : public std::binary_function<const std::string&, const std::string&, bool>
-{
-	bool operator () (const std::string& str, const std::string& target) const {
-		if (str.size() == target.size()) {
-			return (strncasecmp(str.c_str(), target.c_str(), str.size()) == 0);
-		}
-		return false;
-	}
-};
-
-#else
-
-struct StringCILess : public std::binary_function<const std::string&, const std::string&, bool>
-{
-	bool operator () (const std::string& str, const std::string& target) const {
-		return std::lexicagraphical_compare(str.begin(), str.end(), target.begin(), target.end(), CharCILess());
-	}
-};
-
-#endif
-
 } // namespace fastcgi
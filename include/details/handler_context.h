@@ -26,12 +26,16 @@ namespace fastcgi {
 
 class HandlerContextImpl : public HandlerContext {
 public:
+    explicit HandlerContextImpl(Arena *arena = NULL);
+
     virtual boost::any getParam(const std::string &name) const;
     virtual void setParam(const std::string &name, const boost::any &value);
+    virtual Arena* arena() const;
 
 private:
     typedef std::map<std::string, boost::any> ParamsMapType;
     ParamsMapType params_;
+    Arena *arena_;
 };
 
 } // namespace fastcgi
@@ -43,6 +43,9 @@ public:
 		std::vector<Handler*> handlers;
 		std::string poolName;
 		std::string id;
+		unsigned priority;
+		// the handler reads the request body itself as it arrives
+		bool streamBody;
 	};
 	typedef std::vector<HandlerDescription> HandlerArray;
 
@@ -53,6 +56,9 @@ public:
 	void init(const Config *config, const ComponentSet *componentSet);
 
 	const HandlerSet::HandlerDescription* findURIHandler(const Request *request) const;
+	bool hasStreamBodies() const;
+	// the first handler with param filters, which form fields may match once the body is read
+	const HandlerSet::HandlerDescription* findParamHandler() const;
 	void findPoolHandlers(const std::string &poolName, std::set<Handler*> &handlers) const;
 	std::set<std::string> getPoolsNeeded() const;
 
@@ -0,0 +1,60 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include "fastcgi2/data_buffer.h"
+#include "details/data_buffer_impl.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+
+namespace fastcgi {
+
+/**
+ * Buffer kept in a temporary file and mapped into memory. Pages of the file
+ * are not zeroed by the process and go to the page cache rather than the heap,
+ * so a large request body costs no more memory than the kernel decides to keep.
+ * The disk space is allocated when the file is sized, so a full disk fails the
+ * request that needs the space rather than the process.
+ * The file is removed together with the last copy of the buffer unless it has
+ * been renamed by then, so a handler may move an upload in place of copying it.
+ */
+class MappedFileBuffer : public DataBufferImpl {
+public:
+	// creates the file in dir, for example on a tmpfs
+	MappedFileBuffer(const std::string &dir, boost::uint64_t size);
+	virtual ~MappedFileBuffer();
+	virtual boost::uint64_t read(boost::uint64_t pos, char *data, boost::uint64_t len);
+	virtual boost::uint64_t write(boost::uint64_t pos, const char *data, boost::uint64_t len);
+	virtual char at(boost::uint64_t pos);
+	virtual boost::uint64_t find(boost::uint64_t begin, boost::uint64_t end, const char* buf, boost::uint64_t len);
+	virtual std::pair<boost::uint64_t, boost::uint64_t> trim(boost::uint64_t begin, boost::uint64_t end) const;
+	virtual std::pair<char*, boost::uint64_t> chunk(boost::uint64_t pos) const;
+	virtual std::pair<boost::uint64_t, boost::uint64_t> segment(boost::uint64_t pos) const;
+	virtual boost::uint64_t size() const;
+	virtual void resize(boost::uint64_t size);
+	virtual const std::string& filename() const;
+	virtual DataBufferImpl* getCopy() const;
+private:
+	class MappedFile;
+	boost::shared_ptr<MappedFile> file_;
+};
+
+} // namespace fastcgi
@@ -0,0 +1,125 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace fastcgi {
+
+/**
+ * Bounded multi-producer multi-consumer queue (D. Vyukov). Every cell carries a
+ * sequence number telling whether it is ready to be written or read in the
+ * current lap, so push and pop cost one CAS on the shared index and never
+ * allocate. Values are moved in and out of the preallocated cells.
+ */
+template<typename T>
+class MpmcRing : private boost::noncopyable {
+public:
+	explicit MpmcRing(std::size_t capacity) :
+		mask_(roundCapacity(capacity) - 1), cells_(new Cell[mask_ + 1]), enqueue_(0), dequeue_(0)
+	{
+		for (std::size_t i = 0; i <= mask_; ++i) {
+			cells_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	std::size_t capacity() const {
+		return mask_ + 1;
+	}
+
+	bool push(T &&value) {
+		Cell *cell = NULL;
+		std::size_t pos = enqueue_.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells_[pos & mask_];
+			const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+			if (0 == diff) {
+				if (enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = enqueue_.load(std::memory_order_relaxed);
+			}
+		}
+		cell->value = std::move(value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T &value) {
+		Cell *cell = NULL;
+		std::size_t pos = dequeue_.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells_[pos & mask_];
+			const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+			if (0 == diff) {
+				if (dequeue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = dequeue_.load(std::memory_order_relaxed);
+			}
+		}
+		value = std::move(cell->value);
+		cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	static const std::size_t CACHE_LINE_SIZE = 64;
+
+	struct Cell {
+		std::atomic<std::size_t> sequence;
+		T value;
+	};
+
+	static std::size_t roundCapacity(std::size_t capacity) {
+		std::size_t result = 2;
+		while (result < capacity) {
+			result <<= 1;
+		}
+		return result;
+	}
+
+private:
+	char padding0_[CACHE_LINE_SIZE];
+	const std::size_t mask_;
+	const std::unique_ptr<Cell[]> cells_;
+	char padding1_[CACHE_LINE_SIZE];
+	std::atomic<std::size_t> enqueue_;
+	char padding2_[CACHE_LINE_SIZE];
+	std::atomic<std::size_t> dequeue_;
+	char padding3_[CACHE_LINE_SIZE];
+};
+
+} // namespace fastcgi
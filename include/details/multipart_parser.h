@@ -0,0 +1,84 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+
+#include <cstddef>
+#include <string>
+
+#include "details/range.h"
+
+namespace fastcgi {
+
+/**
+ * Single pass parser of a multipart/form-data body. The body is given to feed()
+ * in pieces as it is read, a part is reported as soon as the boundary after it
+ * is seen. Boundaries are looked for with ByteSearch, the last bytes of a piece
+ * are kept to find a boundary that starts in one piece and ends in the next
+ * one, so no byte is looked at twice. Part content is reported by its
+ * offsets in the body, the parser keeps only the headers of the current part.
+ */
+class MultipartParser : private boost::noncopyable {
+public:
+	// headers of the part and offsets of its content in the body
+	typedef boost::function<void(const Range&, boost::uint64_t, boost::uint64_t)> PartHandler;
+
+	// the boundary is given with its leading "--"
+	MultipartParser(const std::string &boundary, PartHandler handler);
+
+	void feed(const char *data, std::size_t size);
+
+	// true once the closing boundary is seen, the rest of the body is ignored
+	bool finished() const;
+
+	static const std::size_t MAX_HEADERS_SIZE = 65536;
+
+private:
+	enum State { CONTENT, BOUNDARY_LINE, CLOSE, HEADERS, FINISHED };
+
+	const char* search(const char *begin, const char *end) const;
+	const char* scanContent(const char *pos, const char *end);
+	const char* scanBoundaryLine(const char *pos, const char *end);
+	const char* scanHeaders(const char *pos, const char *end);
+	const char* delimiterFound(boost::uint64_t start, char prev, const char *next);
+
+	boost::uint64_t offsetOf(const char *pos) const;
+
+private:
+	std::string delimiter_;
+	PartHandler handler_;
+
+	State state_;
+	bool in_part_;
+	boost::uint64_t part_begin_;
+	std::string headers_;
+
+	// offset of the piece being fed
+	boost::uint64_t offset_;
+	const char *piece_;
+
+	// the last bytes before the piece that may start a delimiter
+	std::string tail_;
+	std::string window_;
+};
+
+} // namespace fastcgi
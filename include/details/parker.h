@@ -0,0 +1,75 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <chrono>
+
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace fastcgi {
+
+/**
+ * Futex based binary semaphore a single thread parks on. unpark() before park()
+ * is not lost: the permit is kept and the next park() returns immediately.
+ */
+class Parker : private boost::noncopyable {
+public:
+	Parker() : permit_(0)
+	{}
+
+	void park() {
+		while (0 == permit_.exchange(0)) {
+			syscall(SYS_futex, &permit_, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+		}
+	}
+
+	// returns false if nobody unparked the thread within the timeout
+	bool parkFor(std::chrono::milliseconds timeout) {
+		const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+		while (0 == permit_.exchange(0)) {
+			const std::chrono::steady_clock::duration left = deadline - std::chrono::steady_clock::now();
+			if (left <= std::chrono::steady_clock::duration::zero()) {
+				return false;
+			}
+			const std::chrono::nanoseconds nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(left);
+			struct timespec wait;
+			wait.tv_sec = nanoseconds.count() / 1000000000;
+			wait.tv_nsec = nanoseconds.count() % 1000000000;
+			syscall(SYS_futex, &permit_, FUTEX_WAIT_PRIVATE, 0, &wait, NULL, 0);
+		}
+		return true;
+	}
+
+	void unpark() {
+		if (0 == permit_.exchange(1)) {
+			syscall(SYS_futex, &permit_, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		}
+	}
+
+private:
+	std::atomic<int> permit_;
+};
+
+} // namespace fastcgi
@@ -43,18 +43,24 @@ public:
 
 	static void addCookie(RequestImpl *req, const Range &range);
 	static void addHeader(RequestImpl *req, const Range &key, const Range &value);
+	static void addVariable(RequestImpl *req, const Range &key, const Range &value);
 
 	static void parse(RequestImpl *req, char *env[], Logger* logger);
+	static void parse(RequestImpl *req, const std::vector<std::pair<Range, Range> > &env, Logger* logger);
 	static void parseCookies(RequestImpl *req, const Range &range);
 
-	static void parsePart(RequestImpl *req, DataBuffer part);
-	static void parseLine(DataBuffer line, DataBuffer &name, DataBuffer &filename, DataBuffer &type);
-	static void parseMultipart(RequestImpl *req, DataBuffer data, const std::string &boundary);
+	// the part content is given by its offsets in the body
+	static void parsePart(RequestImpl *req, DataBuffer body, const Range &headers,
+		boost::uint64_t begin, boost::uint64_t end);
+	static void parseLine(Range line, Range &name, Range &filename, Range &type);
 
 	template<typename Map> static bool has(const Map &m, const std::string &key);
 	template<typename Map> static void keys(const Map &m, std::vector<std::string> &v);
 	template<typename Map> static const std::string& get(const Map &m, const std::string &key);
 
+	template<typename Container> static void parseArgs(const Range &range, Container &v);
+	template<typename Container> static void parseArgs(DataBuffer data, Container &v);
+
 	static std::string normalizeInputHeaderName(const Range &range);
 	static std::string normalizeOutputHeaderName(const std::string &name);
 
@@ -95,4 +101,32 @@ Parser::get(const Map &m, const std::string &key) {
 	return (m.end() == i) ? StringUtils::EMPTY_STRING : i->second;
 }
 
+template<typename Container> inline void
+Parser::parseArgs(const Range &range, Container &v) {
+	Range tmp = range;
+	while (!tmp.empty()) {
+		Range key, value, head, tail;
+		tmp.split('&', head, tail);
+		head.split('=', key, value);
+		if (!key.empty()) {
+			v.push_back(StringUtils::NamedValue(StringUtils::urldecode(key), StringUtils::urldecode(value)));
+		}
+		tmp = tail;
+	}
+}
+
+template<typename Container> inline void
+Parser::parseArgs(DataBuffer data, Container &v) {
+	DataBuffer tmp = data;
+	while (!tmp.empty()) {
+		DataBuffer key, value, head, tail;
+		tmp.split('&', head, tail);
+		head.split('=', key, value);
+		if (!key.empty()) {
+			v.push_back(StringUtils::NamedValue(StringUtils::urldecode(key), StringUtils::urldecode(value)));
+		}
+		tmp = tail;
+	}
+}
+
 } // namespace fastcgi
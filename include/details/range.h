@@ -26,6 +26,8 @@
 #include <algorithm>
 #include <string.h>
 
+#include "details/byte_search.h"
+
 namespace fastcgi {
 
 class Range {
@@ -85,16 +87,11 @@ public:
 	}
 
 	const char* find(const Range& substr) const {
-		if (substr.size() == 1) {
-			return find(*substr.begin());
-		}
-		else {
-			return std::search(begin(), end(), substr.begin(), substr.end());
-		}
+		return ByteSearch::find(begin(), end(), substr.begin(), substr.size());
 	}
 
 	const char* find(char ch) const {
-		return std::find(begin(), end(), ch);
+		return ByteSearch::find(begin(), end(), ch);
 	}
 
 	bool split(Range const& delim, Range& first, Range& second) const {
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <boost/function.hpp>
+
 #include <fastcgi2/request.h>
 #include <fastcgi2/request_io_stream.h>
 
@@ -30,10 +32,18 @@ class Handler;
 class Logger;
 
 struct RequestTask {
+	RequestTask() : handlers(NULL), start(0), streamBody(false)
+	{}
+
 	boost::shared_ptr<Request> request;
-	std::vector<Handler*> handlers;
+	// handlers live as long as the handler set, tasks only point to them
+	const std::vector<Handler*> *handlers;
 	boost::shared_ptr<RequestIOStream> request_stream;
 	boost::uint64_t start;
+	// a body left in the stream is read by the pool thread unless the handlers stream it
+	bool streamBody;
+	// called once that body is read, true when it handed the task to other handlers
+	boost::function<bool (RequestTask&)> rematch;
 };
 
 class RequestsThreadPool : public ThreadPool<RequestTask> {
@@ -41,12 +51,18 @@ public:
 	RequestsThreadPool(const unsigned threadsNumber, const unsigned queueLength, fastcgi::Logger *logger);
 	RequestsThreadPool(const unsigned threadsNumber, const unsigned queueLength, boost::uint64_t delay,
 		fastcgi::Logger *logger);
+	RequestsThreadPool(const ThreadPoolSettings &settings, boost::uint64_t delay,
+		const std::string &priorityHeader, fastcgi::Logger *logger);
 	virtual ~RequestsThreadPool();
 	virtual void handleTask(RequestTask task);
 	boost::uint64_t delay() const;
+	unsigned priority(const Request *request, unsigned handlerPriority) const;
+protected:
+	virtual void handleBindError(const std::exception &e);
 private:
 	fastcgi::Logger *logger_;
 	boost::uint64_t delay_;
+	std::string priorityHeader_;
 };
 
 } // namespace fastcgi
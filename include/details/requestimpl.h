@@ -20,17 +20,12 @@
 
 #include "settings.h"
 
-#if defined(HAVE_STLPORT_HASHMAP)
-#include <hash_set>
-#include <hash_map>
-#elif defined(HAVE_EXT_HASH_MAP) || defined(HAVE_GNUCXX_HASHMAP)
-#include <ext/hash_set>
-#include <ext/hash_map>
-#endif
-
+#include "fastcgi2/arena.h"
 #include "fastcgi2/util.h"
 #include "fastcgi2/cookie.h"
 
+#include "details/ci_hash_map.h"
+#include "details/env_map.h"
 #include "details/range.h"
 #include "details/functors.h"
 
@@ -38,6 +33,7 @@
 
 #include <set>
 #include <map>
+#include <mutex>
 #include <iosfwd>
 #include <functional>
 
@@ -58,35 +54,65 @@ private:
 	DataBuffer data_;
 };
 
-#if defined(HAVE_GNUCXX_HASHMAP)
+typedef CIHashMap<std::string> HeaderMap;
+
+typedef std::set<Cookie, std::less<Cookie>, ArenaAllocator<Cookie> > CookieSet;
+typedef std::map<std::string, File, std::less<std::string>,
+	ArenaAllocator<std::pair<const std::string, File> > > FileMap;
+typedef std::vector<StringUtils::NamedValue, ArenaAllocator<StringUtils::NamedValue> > ArgVector;
+typedef std::vector<Range, ArenaAllocator<Range> > RangeVector;
+
+/**
+ * Index of argument names: an open addressing table from a name to its first
+ * position in the argument vector and a chain from every position to the next
+ * one with the same name, so arguments are found without scanning the vector
+ * and values of a name keep their order. The index follows the vector as it
+ * grows and takes its memory from the request arena.
+ */
+class ArgIndex {
+public:
+	static const std::size_t NPOS = static_cast<std::size_t>(-1);
+
+	explicit ArgIndex(Arena *arena);
 
-typedef __gnu_cxx::hash_map<std::string, std::string, StringCIHash> VarMap;
-typedef __gnu_cxx::hash_map<std::string, std::string, StringCIHash, StringCIEqual> HeaderMap;
+	// indexes the arguments added since the last call
+	void update(const ArgVector &args);
 
-#elif defined(HAVE_EXT_HASH_MAP) || defined(HAVE_STLPORT_HASHMAP)
+	std::size_t first(const ArgVector &args, const std::string &name) const;
+	std::size_t next(std::size_t index) const;
 
-typedef std::hash_map<std::string, std::string, StringCIHash> VarMap;
-typedef std::hash_map<std::string, std::string, StringCIHash, StringCIEqual> HeaderMap;
+	// also gives the memory back, the arena may be reset after it
+	void clear();
 
-#else
+private:
+	typedef std::vector<std::size_t, ArenaAllocator<std::size_t> > IndexVector;
 
-typedef std::map<std::string, std::string> VarMap;
-typedef std::map<std::string, std::string, StringCILess> HeaderMap;
+	std::size_t slot(const ArgVector &args, const std::string &name) const;
+	void rehash(const ArgVector &args, std::size_t capacity);
 
-#endif
+private:
+	// first position + 1 of a name, 0 in an empty slot
+	IndexVector slots_;
+	IndexVector next_, last_;
+	std::size_t names_;
+};
 
 class StringCILess;
 
 class Logger;
+class MultipartParser;
 class Request;
 class RequestCache;
 class RequestIOStream;
 
 class RequestImpl : private boost::noncopyable {
 public:
-	RequestImpl(Logger *logger, RequestCache *cache);
+	RequestImpl(Logger *logger, RequestCache *cache, std::size_t arenaSize);
 	~RequestImpl();
 
+	Arena* arena();
+	void setBodyFileThreshold(boost::uint64_t size, const std::string &dir);
+
 	unsigned short getServerPort() const;
 	const std::string& getHost() const;
 	const std::string& getServerAddr() const;
@@ -133,6 +159,8 @@ public:
 
 	bool isSecure() const;
 	DataBuffer requestBody() const;
+	std::streamsize readBody(char *buf, std::streamsize size);
+	bool isBodyStreamed() const;
 
 	void setCookie(const Cookie &cookie);
 	void setStatus(unsigned short status);
@@ -154,6 +182,8 @@ public:
 	void reset();
 	void sendHeaders();
 	void attach(RequestIOStream *stream, char *env[]);
+	void attach(RequestIOStream *stream, const std::vector<std::pair<Range, Range> > &env, bool streamBody);
+	void attachBody();
 
 	unsigned short status() const;
 
@@ -162,11 +192,22 @@ public:
 private:
 	friend class Parser;
 	void sendHeadersInternal();
+	void parseRequest();
+	void parseEntity();
+	void readEntity(boost::uint64_t size, MultipartParser *parser);
 	bool disablePostParams() const;
 
+	void addArg(const std::string &name, const std::string &value);
+	void indexArgs() const;
+	void decodeArgs() const;
+	const std::string& argValue(std::size_t index) const;
+
 	boost::uint64_t serializeEnv(DataBuffer &buffer, boost::uint64_t add_size);
 	boost::uint64_t serializeInt(DataBuffer &buffer, boost::uint64_t pos, boost::uint64_t val);
 	boost::uint64_t serializeString(DataBuffer &buffer, boost::uint64_t pos, const std::string &val);
+	boost::uint64_t serializeString(DataBuffer &buffer, boost::uint64_t pos, const Range &val);
+	boost::uint64_t serializeEnvMap(DataBuffer &buffer, boost::uint64_t pos, const EnvMap &map);
+	static boost::uint64_t envMapSerializedSize(const EnvMap &map);
 	boost::uint64_t serializeBuffer(DataBuffer &buffer, boost::uint64_t pos, const DataBuffer &src);
 	boost::uint64_t serializeFiles(DataBuffer &buffer, boost::uint64_t pos);
 	boost::uint64_t serializeArgs(DataBuffer &buffer, boost::uint64_t pos);
@@ -191,16 +232,45 @@ private:
 	time_t delay_;
 
 	RequestIOStream* stream_;
-	VarMap vars_, cookies_;
+
+	// a streamed body stays in stream_, body_read_ counts the bytes readBody gave out
+	bool stream_body_;
+	boost::uint64_t body_read_;
+
+	// the containers below allocate from the arena and must be declared after it
+	Arena arena_;
+	EnvMap::Buffer env_buffer_;
+	EnvMap vars_, cookies_, headers_;
 	DataBuffer body_;
-	HeaderMap headers_, out_headers_;
 
-	std::set<Cookie> out_cookies_;
-	std::map<std::string, File> files_;
-	std::vector<StringUtils::NamedValue> args_;
+	// a hash map allocates its buckets up front, so it stays on the heap and keeps them across resets
+	HeaderMap out_headers_;
+
+	CookieSet out_cookies_;
+	FileMap files_;
+
+	/**
+	 * Query and form arguments are split and decoded on first access to them.
+	 * Until then only the raw query string and body are kept. The first access
+	 * splits them into args_ with decoded names and raw_args_ with undecoded
+	 * values, a value is decoded into args_ when it is asked for and its raw
+	 * range is emptied then. Arguments of multipart and cached requests are
+	 * decoded as they are parsed. Names are looked up through arg_index_.
+	 */
+	mutable std::mutex args_mutex_;
+	mutable bool args_indexed_;
+	Range query_args_;
+	DataBuffer form_args_;
+	mutable ArgVector args_;
+	mutable RangeVector raw_args_;
+	mutable ArgIndex arg_index_;
 
 	Logger* logger_;
 	RequestCache* cache_;
+
+	// bodies above the threshold go to a MappedFileBuffer, they are not reset with the request
+	boost::uint64_t body_file_threshold_;
+	std::string body_file_dir_;
 };
 
 } // namespace xscript
@@ -38,7 +38,7 @@ protected:
     virtual Logger* logger() const = 0;
 
     void handleRequestInternal(const HandlerSet::HandlerDescription* handler, RequestTask task);
-    const HandlerSet::HandlerDescription* getHandler(RequestTask task) const;
+    const HandlerSet::HandlerDescription* getHandler(const RequestTask &task) const;
 };
 
 } // namespace fastcgi
@@ -23,10 +23,21 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/lexical_cast.hpp>
 
-#include <condition_variable>
+#include "details/cpu_set.h"
+#include "details/mpmc_ring.h"
+#include "details/parker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <stdexcept>
+#include <system_error>
 #include <thread>
+#include <vector>
 
 namespace fastcgi {
 
@@ -34,6 +45,7 @@ struct ThreadPoolInfo
 {
 	bool started;
 	uint64_t threadsNumber;
+	uint64_t maxThreadsNumber;
 	uint64_t queueLength;
 	uint64_t busyThreadsCounter;
 	uint64_t currentQueue;
@@ -41,6 +53,46 @@ struct ThreadPoolInfo
 	uint64_t badTasksCounter;
 };
 
+struct ThreadPoolSettings
+{
+	ThreadPoolSettings() : threadsNumber(0), minThreadsNumber(0), idleTimeout(0), queueLength(0), spinTime(0),
+		priorities(1), lifoThreshold(0)
+	{}
+
+	unsigned threadsNumber;
+	unsigned minThreadsNumber; // 0 keeps all threadsNumber threads running
+	unsigned idleTimeout; // milliseconds, 0 never stops spare threads
+	unsigned queueLength;
+	unsigned spinTime; // microseconds
+	CpuSet cpus; // empty leaves threads unbound
+	unsigned priorities; // 0 is the most urgent one
+	unsigned lifoThreshold; // 0 keeps the queue FIFO under any load
+};
+
+/**
+ * Every worker owns a shard of the queue, a lock-free ring. Producers spread
+ * tasks over the shards, a worker takes tasks from its own shard first and
+ * steals from the others when it runs dry. Tasks are moved through the rings,
+ * never copied.
+ *
+ * A worker that finds no task spins for spinTime microseconds, then puts
+ * itself on the idle stack and parks on its own futex. Producers pop the most
+ * recently idle worker and wake only that one.
+ *
+ * An elastic pool starts minThreadsNumber threads. A producer starts one more,
+ * up to threadsNumber, when busy threads and queued tasks outnumber the running
+ * threads and nobody is idle. A spare thread parked longer than idleTimeout
+ * exits.
+ *
+ * Threads of a pool with cpus are bound to them and the queue memory is first
+ * touched by a thread bound the same way, so it lands on their NUMA node.
+ *
+ * The queue is split into priority partitions with their own shards, workers
+ * drain more urgent partitions first. Once more than lifoThreshold tasks are
+ * queued new tasks go to the stack of their partition, which workers empty
+ * before the rings: under overload the freshest tasks are served first while
+ * the stale ones wait in the rings for the overload to pass.
+ */
 template<typename T>
 class ThreadPool : private boost::noncopyable {
 public:
@@ -48,15 +100,43 @@ public:
 	typedef std::function<void ()> InitFuncType;
 
 public:
-	ThreadPool(const unsigned threadsNumber, const unsigned queueLength)
+	ThreadPool(const unsigned threadsNumber, const unsigned queueLength) :
+		threadsNumber_(threadsNumber), minThreadsNumber_(threadsNumber), idleTimeout_(0),
+		queueLength_(queueLength), spinTime_(0), shardsNumber_(threadsNumber ? threadsNumber : 1),
+		prioritiesNumber_(1), lifoThreshold_(0), threads_(shardsNumber_), started_(false), running_(0),
+		size_(0), next_(0), idleCount_(0), busyThreadsCounter_(0), goodTasksCounter_(0), badTasksCounter_(0)
+	{
+		init();
+	}
+
+	explicit ThreadPool(const ThreadPoolSettings &settings) :
+		threadsNumber_(settings.threadsNumber),
+		minThreadsNumber_(settings.minThreadsNumber && settings.minThreadsNumber < settings.threadsNumber ?
+			settings.minThreadsNumber : settings.threadsNumber),
+		idleTimeout_(settings.idleTimeout), queueLength_(settings.queueLength), spinTime_(settings.spinTime),
+		cpus_(settings.cpus), shardsNumber_(threadsNumber_ ? threadsNumber_ : 1),
+		prioritiesNumber_(settings.priorities ? settings.priorities : 1), lifoThreshold_(settings.lifoThreshold),
+		threads_(shardsNumber_), started_(false), running_(0), size_(0), next_(0), idleCount_(0),
+		busyThreadsCounter_(0), goodTasksCounter_(0), badTasksCounter_(0)
 	{
-		info_.started = false;
-		info_.threadsNumber = threadsNumber;
-		info_.queueLength = queueLength;
-		info_.busyThreadsCounter = 0;
-		info_.currentQueue = 0;
-		info_.goodTasksCounter = 0;
-		info_.badTasksCounter = 0;
+		if (cpus_.empty()) {
+			init();
+			return;
+		}
+		std::exception_ptr error;
+		std::thread thread([this, &error] {
+			try {
+				cpus_.apply();
+				init();
+			}
+			catch (...) {
+				error = std::current_exception();
+			}
+		});
+		thread.join();
+		if (error) {
+			std::rethrow_exception(error);
+		}
 	}
 
 	virtual ~ThreadPool() {
@@ -66,126 +146,362 @@ public:
 
 	void start(InitFuncType func) {
 		std::lock_guard<std::mutex> lock(mutex_);
-		if (info_.started) {
+		if (started_) {
 			return;
 		}
-//		if (threads_.size() != 0) {
-//			throw std::runtime_error("Invalid thread pool state.");
-//		}
 
-		std::function<void()> f = boost::bind(&ThreadPool<T>::workMethod, this, func);
-		for (unsigned i = 0; i < info_.threadsNumber; ++i) {
-			threads_.emplace_back(f);
+		started_ = true;
+		func_ = func;
+		for (unsigned i = 0; i < minThreadsNumber_; ++i) {
+			startThread(i);
 		}
-
-		info_.started = true;
 	}
 
 	void stop() {
 		std::lock_guard<std::mutex> lock(mutex_);
-		info_.started = false;
-		condition_.notify_all();
+		started_ = false;
+		for (unsigned i = 0; i < shardsNumber_; ++i) {
+			workers_[i].parker.unpark();
+		}
 	}
 
-    void join() {
-        for (auto& thread : threads_) {
-            if (thread.joinable()) {
-                thread.join();
-            }
-        }
-    }
+	void join() {
+		for (auto& thread : threads_) {
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+	}
 
-    void addTask(T task) {
-		try {
-			std::lock_guard<std::mutex> lock(mutex_);
+	void addTask(const T &task, unsigned priority = 0) {
+		T copy(task);
+		addTask(std::move(copy), priority);
+	}
 
-			if (!info_.started) {
-				throw std::runtime_error("Thread pool is not started yet");
-			}
+	// the task is left untouched if it can not be queued
+	void addTask(T &&task, unsigned priority = 0) {
+		if (!started_) {
+			throw std::runtime_error("Thread pool is not started yet");
+		}
+
+		const uint64_t queued = size_.fetch_add(1);
+		if (queued >= queueLength_) {
+			size_.fetch_sub(1);
+			throw std::runtime_error("Pool::handle: the queue has already reached its maximum size of "
+					+ boost::lexical_cast<std::string>(queueLength_) + " elements");
+		}
 
-			if (tasksQueue_.size() >= info_.queueLength) {
-				throw std::runtime_error("Pool::handle: the queue has already reached its maximum size of "
-						+ boost::lexical_cast<std::string>(info_.queueLength) + " elements");
+		Partition &partition = *partitions_[std::min(priority, prioritiesNumber_ - 1)];
+		if (lifoThreshold_ && queued >= lifoThreshold_) {
+			std::lock_guard<std::mutex> lock(partition.stackMutex);
+			partition.stack.push_back(std::move(task));
+			partition.stackSize.fetch_add(1);
+		}
+		else {
+			// together the shards have room for queueLength tasks, so one of them has a free cell
+			unsigned index = next_.fetch_add(1, std::memory_order_relaxed);
+			while (!partition.shards[index % shardsNumber_]->push(std::move(task))) {
+				++index;
 			}
-			tasksQueue_.push(task);
-		} catch (...) {
-			condition_.notify_one();
-			throw;
 		}
-		condition_.notify_one();
+
+		if (idleCount_.load() > 0) {
+			wakeWorker();
+		}
+		else if (running_.load() < threadsNumber_ && busyThreadsCounter_.load() + size_.load() > running_.load()) {
+			addThread();
+		}
+	}
+
+	const CpuSet& cpus() const {
+		return cpus_;
 	}
 
 	ThreadPoolInfo getInfo() const {
-		std::lock_guard<std::mutex> lock(mutex_);
-		info_.currentQueue = tasksQueue_.size();
-		return info_;
+		ThreadPoolInfo info;
+		info.started = started_;
+		info.threadsNumber = running_;
+		info.maxThreadsNumber = threadsNumber_;
+		info.queueLength = queueLength_;
+		info.busyThreadsCounter = busyThreadsCounter_;
+		info.currentQueue = size_;
+		info.goodTasksCounter = goodTasksCounter_;
+		info.badTasksCounter = badTasksCounter_;
+		return info;
 	}
 
 protected:
 	virtual void handleTask(T) = 0;
 
+	// a worker could not bind itself to the configured cpus and runs unpinned
+	virtual void handleBindError(const std::exception &) {
+	}
+
 private:
-	void workMethod(InitFuncType func) {
-		const int none = 0;
-		const int good = 1;
-		const int bad = 2;
-		int state = none;
+	struct Worker {
+		Worker() : idle(false), running(false)
+		{}
+
+		Parker parker;
+		bool idle;
+		bool running; // guarded by mutex_
+		char padding[64];
+	};
+
+	struct Partition {
+		Partition() : stackSize(0)
+		{}
+
+		std::vector<std::unique_ptr<MpmcRing<T> > > shards;
+		std::mutex stackMutex;
+		std::vector<T> stack;
+		std::atomic<unsigned> stackSize;
+	};
+
+	void init() {
+		workers_.reset(new Worker[shardsNumber_]);
+		const unsigned shardCapacity = (queueLength_ + shardsNumber_ - 1) / shardsNumber_;
+		for (unsigned p = 0; p < prioritiesNumber_; ++p) {
+			partitions_.emplace_back(new Partition());
+			for (unsigned i = 0; i < shardsNumber_; ++i) {
+				partitions_.back()->shards.emplace_back(new MpmcRing<T>(shardCapacity));
+			}
+			if (lifoThreshold_ && lifoThreshold_ < queueLength_) {
+				partitions_.back()->stack.reserve(queueLength_ - lifoThreshold_);
+			}
+		}
+		idle_.reserve(shardsNumber_);
+	}
+
+	// mutex_ must be held
+	void startThread(unsigned index) {
+		if (threads_[index].joinable()) {
+			// the thread has retired, it is leaving workMethod or has already left it
+			threads_[index].join();
+		}
+		try {
+			threads_[index] = std::thread(boost::bind(&ThreadPool<T>::workMethod, this, index));
+		}
+		catch (const std::system_error&) {
+			return;
+		}
+		workers_[index].running = true;
+		running_.fetch_add(1);
+	}
+
+	void addThread() {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!started_ || running_.load() >= threadsNumber_) {
+			return;
+		}
+		for (unsigned i = 0; i < shardsNumber_; ++i) {
+			if (!workers_[i].running) {
+				startThread(i);
+				return;
+			}
+		}
+	}
+
+	bool retireThread(unsigned index) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (!started_ || running_.load() <= minThreadsNumber_) {
+			return false;
+		}
+		// a producer that missed the idle worker checks the running count after
+		// its push, the retiring thread checks the queue after the decrement
+		running_.fetch_sub(1);
+		if (size_.load() > 0) {
+			running_.fetch_add(1);
+			return false;
+		}
+		workers_[index].running = false;
+		return true;
+	}
+
+	bool popStack(Partition &partition, T &task) {
+		std::lock_guard<std::mutex> lock(partition.stackMutex);
+		if (partition.stack.empty()) {
+			return false;
+		}
+		task = std::move(partition.stack.back());
+		partition.stack.pop_back();
+		partition.stackSize.fetch_sub(1);
+		return true;
+	}
+
+	bool popTask(unsigned index, T &task) {
+		for (unsigned p = 0; p < prioritiesNumber_; ++p) {
+			Partition &partition = *partitions_[p];
+			bool found = partition.stackSize.load() > 0 && popStack(partition, task);
+			for (unsigned i = 0; !found && i < shardsNumber_; ++i) {
+				found = partition.shards[(index + i) % shardsNumber_]->pop(task);
+			}
+			if (found) {
+				size_.fetch_sub(1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void relax() {
+#if defined(__i386__) || defined(__x86_64__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	bool spinTask(unsigned index, T &task) {
+		if (0 == spinTime_) {
+			return false;
+		}
+		const std::chrono::steady_clock::time_point deadline =
+			std::chrono::steady_clock::now() + std::chrono::microseconds(spinTime_);
+		do {
+			for (int i = 0; i < 32; ++i) {
+				relax();
+			}
+			if (popTask(index, task)) {
+				return true;
+			}
+		} while (started_ && std::chrono::steady_clock::now() < deadline);
+		return false;
+	}
+
+	void pushIdle(unsigned index) {
+		std::lock_guard<std::mutex> lock(idleMutex_);
+		workers_[index].idle = true;
+		idle_.push_back(index);
+		idleCount_.fetch_add(1);
+	}
+
+	bool removeIdle(unsigned index) {
+		std::lock_guard<std::mutex> lock(idleMutex_);
+		if (!workers_[index].idle) {
+			return false;
+		}
+		workers_[index].idle = false;
+		idle_.erase(std::find(idle_.begin(), idle_.end(), index));
+		idleCount_.fetch_sub(1);
+		return true;
+	}
 
+	void wakeWorker() {
+		unsigned index = 0;
+		{
+			std::lock_guard<std::mutex> lock(idleMutex_);
+			if (idle_.empty()) {
+				return;
+			}
+			index = idle_.back();
+			idle_.pop_back();
+			workers_[index].idle = false;
+			idleCount_.fetch_sub(1);
+		}
+		workers_[index].parker.unpark();
+	}
+
+	bool waitTask(unsigned index, T &task) {
+		while (true) {
+			if (!started_) {
+				return false;
+			}
+			if (popTask(index, task) || spinTask(index, task)) {
+				return true;
+			}
+
+			// the worker is published as idle before the queue is checked while
+			// producers push first and check the idle count after, so one of
+			// them always sees the other
+			pushIdle(index);
+			if (size_.load() > 0 || !started_) {
+				if (removeIdle(index)) {
+					continue;
+				}
+				// a producer has already taken the worker off the stack and
+				// unparked it, park() consumes that permit and returns at once
+			}
+			else if (idleTimeout_ > 0 && minThreadsNumber_ < threadsNumber_) {
+				if (workers_[index].parker.parkFor(std::chrono::milliseconds(idleTimeout_))) {
+					continue;
+				}
+				if (removeIdle(index)) {
+					if (retireThread(index)) {
+						return false;
+					}
+					continue;
+				}
+			}
+			workers_[index].parker.park();
+		}
+	}
+
+	void workMethod(unsigned index) {
 		try {
-			func();
+			if (!cpus_.empty()) {
+				cpus_.apply();
+			}
+		}
+		catch (const std::exception &e) {
+			handleBindError(e);
+		}
+		catch (...) {
+		}
+
+		try {
+			func_();
 		}
 		catch (...) {
 		}
 
 		while (true) {
-            try {
-                T task;
-                {
-                    std::unique_lock<std::mutex> lock(mutex_);
-                    switch (state) {
-                        case none:
-                            break;
-                        case good:
-                            ++info_.goodTasksCounter;
-                            --info_.busyThreadsCounter;
-                            break;
-                        case bad:
-                            ++info_.badTasksCounter;
-                            --info_.busyThreadsCounter;
-                            break;
-                    }
-                    state = none;
-                    while (true) {
-                        if (!info_.started) {
-                            return;
-                        } else if (!tasksQueue_.empty()) {
-                            break;
-                        }
-                        condition_.wait(lock);
-                    }
-                    task = tasksQueue_.front();
-                    tasksQueue_.pop();
-                    ++info_.busyThreadsCounter;
-                }
-
-                try {
-                    handleTask(task);
-                    state = good;
-                } catch (...) {
-                    state = bad;
-                }
-            } catch (...) {
-            }
-        }
+			try {
+				T task;
+				if (!waitTask(index, task)) {
+					return;
+				}
+
+				++busyThreadsCounter_;
+				try {
+					handleTask(std::move(task));
+					++goodTasksCounter_;
+				} catch (...) {
+					++badTasksCounter_;
+				}
+				--busyThreadsCounter_;
+			} catch (...) {
+			}
+		}
 	}
 
 private:
-	mutable std::mutex mutex_;
+	const unsigned threadsNumber_;
+	const unsigned minThreadsNumber_;
+	const unsigned idleTimeout_;
+	const unsigned queueLength_;
+	const unsigned spinTime_;
+	const CpuSet cpus_;
+	const unsigned shardsNumber_;
+	const unsigned prioritiesNumber_;
+	const unsigned lifoThreshold_;
+	std::vector<std::unique_ptr<Partition> > partitions_;
+	std::unique_ptr<Worker[]> workers_;
 
-	std::condition_variable condition_;
+	std::mutex mutex_;
 	std::vector<std::thread> threads_;
-	std::queue<T> tasksQueue_;
-	mutable ThreadPoolInfo info_;
+	InitFuncType func_;
+	std::atomic<bool> started_;
+	std::atomic<unsigned> running_;
+
+	std::atomic<uint64_t> size_;
+	std::atomic<unsigned> next_;
+
+	std::mutex idleMutex_;
+	std::vector<unsigned> idle_;
+	std::atomic<unsigned> idleCount_;
+
+	std::atomic<uint64_t> busyThreadsCounter_;
+	std::atomic<uint64_t> goodTasksCounter_;
+	std::atomic<uint64_t> badTasksCounter_;
 };
 
 } // namespace fastcgi
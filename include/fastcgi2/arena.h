@@ -0,0 +1,121 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+// Copyright (C) 2017 Kirill Shmakov <menato@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#pragma once
+
+#include <boost/utility.hpp>
+
+#include <cstddef>
+
+namespace fastcgi {
+
+/**
+ * Monotonic allocator living as long as a request. Memory is taken from blocks
+ * by bumping a pointer and is never freed one by one: reset() and the
+ * destructor drop everything at once. Blocks of released arenas are kept in a
+ * per-thread cache, so a thread serving requests reuses them instead of
+ * calling malloc.
+ */
+class Arena : private boost::noncopyable {
+public:
+    explicit Arena(std::size_t blockSize = DEFAULT_BLOCK_SIZE);
+    ~Arena();
+
+    void* allocate(std::size_t size, std::size_t alignment = DEFAULT_ALIGNMENT);
+
+    // keeps the first block, the rest goes back to the thread cache
+    void reset();
+
+    std::size_t blockSize() const;
+
+    static const std::size_t DEFAULT_BLOCK_SIZE = 16384;
+    static const std::size_t DEFAULT_ALIGNMENT = 16;
+
+private:
+    struct Block;
+    void* allocateSlow(std::size_t size, std::size_t alignment);
+    void releaseBlock(Block *block);
+
+private:
+    Block *blocks_;
+    char *current_, *end_;
+    std::size_t block_size_;
+};
+
+inline void*
+Arena::allocate(std::size_t size, std::size_t alignment) {
+    char *result = reinterpret_cast<char*>(
+        (reinterpret_cast<std::size_t>(current_) + alignment - 1) & ~(alignment - 1));
+    if (result + size > end_) {
+        return allocateSlow(size, alignment);
+    }
+    current_ = result + size;
+    return result;
+}
+
+/**
+ * Standard allocator drawing from an arena, deallocate() is a no-op.
+ */
+template<typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template<typename U> struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    explicit ArenaAllocator(Arena *arena) : arena_(arena) {
+    }
+
+    template<typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {
+    }
+
+    pointer allocate(size_type n, const void* = 0) {
+        return static_cast<pointer>(arena_->allocate(n * sizeof(T),
+            alignof(T) > Arena::DEFAULT_ALIGNMENT ? alignof(T) : Arena::DEFAULT_ALIGNMENT));
+    }
+
+    void deallocate(pointer, size_type) {
+    }
+
+    Arena* arena() const {
+        return arena_;
+    }
+
+private:
+    Arena *arena_;
+};
+
+template<typename T, typename U> inline bool
+operator == (const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) {
+    return lhs.arena() == rhs.arena();
+}
+
+template<typename T, typename U> inline bool
+operator != (const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) {
+    return lhs.arena() != rhs.arena();
+}
+
+} // namespace fastcgi
@@ -21,6 +21,7 @@
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
 
+#include <string>
 #include <utility>
 
 namespace fastcgi {
@@ -67,6 +68,10 @@ public:
 	boost::uint64_t beginIndex() const;
 	boost::uint64_t endIndex() const;
 
+	// file the buffer is kept in, empty for a buffer in memory and for a slice
+	// of a file; the file may be renamed to keep it after the request
+	const std::string& filename() const;
+
 	DataBufferImpl* impl() const;
 
 private:
@@ -79,6 +84,11 @@ private:
 	boost::uint64_t end_;
 };
 
+/**
+ * Iterates over the contiguous parts of a buffer. The iterator borrows the
+ * storage of the buffer and does not hold it, so taking one costs nothing but
+ * the buffer has to outlive it.
+ */
 class DataBuffer::SegmentIterator {
 public:
 	SegmentIterator();
@@ -95,9 +105,10 @@ private:
 	SegmentIterator(const DataBuffer &buffer); // begin iterator
 	DataBufferImpl* impl() const;
 private:
-	DataBuffer buffer_;
+	DataBufferImpl *impl_;
 	boost::uint64_t pos_begin_;
 	boost::uint64_t pos_end_;
+	boost::uint64_t end_;
 	mutable std::pair<char*, boost::uint64_t> data_;
 };
 
@@ -27,6 +27,7 @@
 
 namespace fastcgi {
 
+class Arena;
 class Request;
 
 class HandlerContext {
@@ -35,6 +36,9 @@ public:
 
     virtual boost::any getParam(const std::string &name) const = 0;
     virtual void setParam(const std::string &name, const boost::any &value) = 0;
+
+    // scratch memory of the request, NULL when the context has none
+    virtual Arena* arena() const;
 };
 
 class Handler : private boost::noncopyable {
@@ -23,13 +23,16 @@
 #include <boost/utility.hpp>
 
 #include <string>
+#include <utility>
 #include <vector>
 #include <memory>
 
 namespace fastcgi {
 
+class Arena;
 class Cookie;
 class Logger;
+class Range;
 class RequestCache;
 class RequestIOStream;
 class RequestImpl;
@@ -37,8 +40,15 @@ class RequestImpl;
 class Request : private boost::noncopyable {
 public:
     Request(Logger *logger, RequestCache *cache);
+    Request(Logger *logger, RequestCache *cache, std::size_t arenaSize);
     ~Request();
 
+    // memory released all at once together with the request
+    Arena* arena();
+
+    // bodies larger than size are kept in a mapped file in dir, 0 keeps all of them in memory
+    void setBodyFileThreshold(boost::uint64_t size, const std::string &dir);
+
     unsigned short getServerPort() const;
     const std::string& getHost() const;
     const std::string& getServerAddr() const;
@@ -89,6 +99,10 @@ public:
     bool isSecure() const;
     DataBuffer requestBody() const;
 
+    // reads the next part of the body, returns 0 at its end; a streamed body can only be read this way
+    std::streamsize readBody(char *buf, std::streamsize size);
+    bool isBodyStreamed() const;
+
     void setCookie(const Cookie &cookie);
     void setStatus(unsigned short status);
     void sendError(unsigned short status);
@@ -99,8 +113,15 @@ public:
     std::string outputHeader(const std::string &name) const;
 
     void reset();
+    // saves the request to the cache like the destructor does and resets it for another request
+    void recycle();
     void sendHeaders();
     void attach(RequestIOStream *stream, char *env[]);
+    // with streamBody the body is left in the stream for readBody
+    void attach(RequestIOStream *stream, const std::vector<std::pair<Range, Range> > &env,
+        bool streamBody = false);
+    // reads and parses the body a streamBody attach left in the stream
+    void attachBody();
 
     bool isProcessed() const;
     void markAsProcessed();
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <sys/uio.h>
+
 namespace fastcgi {
 
 class RequestIOStream {
@@ -26,6 +28,13 @@ public:
     virtual int write(const char *buf, int size) = 0;
     virtual void write(std::streambuf *buf) = 0;
     virtual void flush() = 0;
+
+    // writes the pieces in order, a stream that can send them at once overrides it
+    virtual void write(const struct iovec *iov, int count) {
+        for (int i = 0; i < count; ++i) {
+            write(static_cast<const char*>(iov[i].iov_base), static_cast<int>(iov[i].iov_len));
+        }
+    }
 };
 
 } // namespace fastcgi
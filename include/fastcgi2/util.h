@@ -37,6 +37,13 @@ public:
 	static std::string urldecode(DataBuffer data);
 	static std::string urldecode(const std::string &val);
 
+	// decodes into a buffer of at least val.size() bytes, returns the end of the result
+	static char* urldecode(const Range &val, char *result);
+
+	// encodes into a buffer of at least urlencodedSize(val) bytes, returns the end of the result
+	static char* urlencode(const Range &val, char *result);
+	static std::size_t urlencodedSize(const Range &val);
+
 	typedef std::pair<std::string, std::string> NamedValue;
 
 	static void parse(const Range &range, std::vector<NamedValue> &v);
@@ -0,0 +1,160 @@
+#include "settings.h"
+
+#include <cstdlib>
+#include <new>
+
+#include "fastcgi2/arena.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const unsigned int MAX_CACHED_BLOCKS = 64;
+
+struct Arena::Block {
+	Block *next;
+	std::size_t size;
+
+	char* begin() {
+		return reinterpret_cast<char*>(this) + HEADER_SIZE;
+	}
+
+	char* end() {
+		return begin() + size;
+	}
+
+	static const std::size_t HEADER_SIZE = 2 * Arena::DEFAULT_ALIGNMENT;
+};
+
+class BlockCache {
+public:
+	BlockCache() : blocks_(NULL), size_(0), count_(0)
+	{}
+
+	~BlockCache() {
+		while (blocks_) {
+			void *block = blocks_;
+			blocks_ = *static_cast<void**>(block);
+			free(block);
+		}
+	}
+
+	void* acquire(std::size_t size) {
+		if (blocks_ && size == size_) {
+			void *block = blocks_;
+			blocks_ = *static_cast<void**>(block);
+			--count_;
+			return block;
+		}
+		void *block = malloc(size);
+		if (NULL == block) {
+			throw std::bad_alloc();
+		}
+		return block;
+	}
+
+	// the cache holds blocks of one size, the size of the blocks released last
+	void release(void *block, std::size_t size) {
+		if ((count_ > 0 && size != size_) || count_ >= MAX_CACHED_BLOCKS) {
+			free(block);
+			return;
+		}
+		size_ = size;
+		*static_cast<void**>(block) = blocks_;
+		blocks_ = block;
+		++count_;
+	}
+
+private:
+	void *blocks_;
+	std::size_t size_;
+	unsigned int count_;
+};
+
+static thread_local BlockCache blockCache;
+
+Arena::Arena(std::size_t blockSize) :
+	blocks_(NULL), current_(NULL), end_(NULL), block_size_(blockSize ? blockSize : DEFAULT_BLOCK_SIZE)
+{}
+
+Arena::~Arena() {
+	while (blocks_) {
+		Block *block = blocks_;
+		blocks_ = block->next;
+		releaseBlock(block);
+	}
+}
+
+void
+Arena::reset() {
+	Block *kept = NULL;
+	while (blocks_) {
+		Block *block = blocks_;
+		blocks_ = block->next;
+		if (NULL == kept && block_size_ == block->size) {
+			kept = block;
+		}
+		else {
+			releaseBlock(block);
+		}
+	}
+	blocks_ = kept;
+	if (kept) {
+		kept->next = NULL;
+		current_ = kept->begin();
+		end_ = kept->end();
+	}
+	else {
+		current_ = end_ = NULL;
+	}
+}
+
+void
+Arena::releaseBlock(Block *block) {
+	// only standard blocks are worth caching, large ones go back to malloc
+	if (block_size_ == block->size) {
+		blockCache.release(block, block->size + Block::HEADER_SIZE);
+	}
+	else {
+		free(block);
+	}
+}
+
+std::size_t
+Arena::blockSize() const {
+	return block_size_;
+}
+
+void*
+Arena::allocateSlow(std::size_t size, std::size_t alignment) {
+	const std::size_t needed = size + alignment;
+	if (needed > block_size_ / 2) {
+		// a large chunk gets a block of its own behind the current one
+		Block *block = static_cast<Block*>(blockCache.acquire(needed + Block::HEADER_SIZE));
+		block->size = needed;
+		if (blocks_) {
+			block->next = blocks_->next;
+			blocks_->next = block;
+		}
+		else {
+			block->next = NULL;
+			blocks_ = block;
+			current_ = end_ = block->end();
+		}
+		return reinterpret_cast<char*>(
+			(reinterpret_cast<std::size_t>(block->begin()) + alignment - 1) & ~(alignment - 1));
+	}
+
+	Block *block = static_cast<Block*>(blockCache.acquire(block_size_ + Block::HEADER_SIZE));
+	block->size = block_size_;
+	block->next = blocks_;
+	blocks_ = block;
+	current_ = block->begin();
+	end_ = block->end();
+	return allocate(size, alignment);
+}
+
+} // namespace fastcgi
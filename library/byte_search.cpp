@@ -0,0 +1,344 @@
+#include "settings.h"
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "details/byte_search.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+struct SearchKernels {
+	// the substring has two bytes at least
+	const char* (*findString)(const char *begin, const char *end, const char *str, std::size_t size);
+	bool (*equalsCI)(const char *lhs, const char *rhs, std::size_t size);
+	const char* (*findEscape)(const char *begin, const char *end);
+	const char* (*findUnsafe)(const char *begin, const char *end);
+	std::size_t (*countUnsafe)(const char *begin, const char *end);
+};
+
+static inline char
+foldCase(char c) {
+	return (c >= 'A' && c <= 'Z') ? static_cast<char>(c | 0x20) : c;
+}
+
+static const char*
+findStringScalar(const char *begin, const char *end, const char *str, std::size_t size) {
+	const void *found = memmem(begin, end - begin, str, size);
+	return found ? static_cast<const char*>(found) : end;
+}
+
+static bool
+equalsCIScalar(const char *lhs, const char *rhs, std::size_t size) {
+	for (const char *end = lhs + size; lhs != end; ++lhs, ++rhs) {
+		if (foldCase(*lhs) != foldCase(*rhs)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static inline bool
+isUrlSafe(char c) {
+	switch (c) {
+		case '-': case '_': case '.': case '!': case '~':
+		case '*': case '(': case ')': case '\'':
+			return true;
+		default:
+			return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+	}
+}
+
+static const char*
+findEscapeScalar(const char *begin, const char *end) {
+	while (begin != end && '%' != *begin && '+' != *begin) {
+		++begin;
+	}
+	return begin;
+}
+
+static const char*
+findUnsafeScalar(const char *begin, const char *end) {
+	while (begin != end && isUrlSafe(*begin)) {
+		++begin;
+	}
+	return begin;
+}
+
+static std::size_t
+countUnsafeScalar(const char *begin, const char *end) {
+	std::size_t count = 0;
+	for (; begin != end; ++begin) {
+		count += !isUrlSafe(*begin);
+	}
+	return count;
+}
+
+#ifdef __SSE2__
+
+static inline __m128i
+load(const char *p) {
+	return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+static inline unsigned int
+escapeMask(__m128i bytes) {
+	return _mm_movemask_epi8(_mm_or_si128(
+		_mm_cmpeq_epi8(bytes, _mm_set1_epi8('%')), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('+'))));
+}
+
+// bytes from first to last, bytes above 0x7f are negative and never match
+static inline __m128i
+inRange(__m128i bytes, char first, char last) {
+	return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(first - 1)),
+		_mm_cmplt_epi8(bytes, _mm_set1_epi8(last + 1)));
+}
+
+static inline unsigned int
+unsafeMask(__m128i bytes) {
+	__m128i safe = _mm_or_si128(_mm_or_si128(inRange(bytes, 'a', 'z'), inRange(bytes, 'A', 'Z')),
+		_mm_or_si128(inRange(bytes, '0', '9'), inRange(bytes, '\'', '*')));
+	safe = _mm_or_si128(safe, _mm_or_si128(inRange(bytes, '-', '.'), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_'))));
+	safe = _mm_or_si128(safe, _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('!')),
+		_mm_cmpeq_epi8(bytes, _mm_set1_epi8('~'))));
+	return ~_mm_movemask_epi8(safe) & 0xFFFF;
+}
+
+static inline __m128i
+foldCaseSse2(__m128i bytes) {
+	const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)),
+		_mm_cmplt_epi8(bytes, _mm_set1_epi8('Z' + 1)));
+	return _mm_or_si128(bytes, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static const char*
+findStringSse2(const char *begin, const char *end, const char *str, std::size_t size) {
+	const __m128i first = _mm_set1_epi8(str[0]);
+	const __m128i last = _mm_set1_epi8(str[size - 1]);
+	// the 16 candidates of a step and their last bytes are all inside the range
+	for (; static_cast<std::size_t>(end - begin) >= size + 15; begin += 16) {
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(first, load(begin)), _mm_cmpeq_epi8(last, load(begin + size - 1))));
+		while (mask) {
+			const char *candidate = begin + __builtin_ctz(mask);
+			if (0 == memcmp(candidate + 1, str + 1, size - 2)) {
+				return candidate;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return findStringScalar(begin, end, str, size);
+}
+
+static bool
+equalsCISse2(const char *lhs, const char *rhs, std::size_t size) {
+	for (; size >= 16; lhs += 16, rhs += 16, size -= 16) {
+		if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi8(foldCaseSse2(load(lhs)), foldCaseSse2(load(rhs))))) {
+			return false;
+		}
+	}
+	return equalsCIScalar(lhs, rhs, size);
+}
+
+static const char*
+findEscapeSse2(const char *begin, const char *end) {
+	for (; end - begin >= 16; begin += 16) {
+		unsigned int mask = escapeMask(load(begin));
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findEscapeScalar(begin, end);
+}
+
+static const char*
+findUnsafeSse2(const char *begin, const char *end) {
+	for (; end - begin >= 16; begin += 16) {
+		unsigned int mask = unsafeMask(load(begin));
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findUnsafeScalar(begin, end);
+}
+
+static std::size_t
+countUnsafeSse2(const char *begin, const char *end) {
+	std::size_t count = 0;
+	for (; end - begin >= 16; begin += 16) {
+		count += __builtin_popcount(unsafeMask(load(begin)));
+	}
+	return count + countUnsafeScalar(begin, end);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#define FASTCGI_HAVE_AVX2_KERNELS
+
+#define FASTCGI_AVX2 __attribute__((target("avx2")))
+
+static FASTCGI_AVX2 inline __m256i
+loadAvx2(const char *p) {
+	return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+static FASTCGI_AVX2 inline unsigned int
+escapeMaskAvx2(__m256i bytes) {
+	return _mm256_movemask_epi8(_mm256_or_si256(
+		_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('%')), _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('+'))));
+}
+
+static FASTCGI_AVX2 inline __m256i
+inRangeAvx2(__m256i bytes, char first, char last) {
+	return _mm256_andnot_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(last)),
+		_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8(first - 1)));
+}
+
+static FASTCGI_AVX2 inline unsigned int
+unsafeMaskAvx2(__m256i bytes) {
+	__m256i safe = _mm256_or_si256(_mm256_or_si256(inRangeAvx2(bytes, 'a', 'z'), inRangeAvx2(bytes, 'A', 'Z')),
+		_mm256_or_si256(inRangeAvx2(bytes, '0', '9'), inRangeAvx2(bytes, '\'', '*')));
+	safe = _mm256_or_si256(safe, _mm256_or_si256(inRangeAvx2(bytes, '-', '.'),
+		_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_'))));
+	safe = _mm256_or_si256(safe, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('!')),
+		_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('~'))));
+	return ~static_cast<unsigned int>(_mm256_movemask_epi8(safe));
+}
+
+static FASTCGI_AVX2 inline __m256i
+foldCaseAvx2(__m256i bytes) {
+	const __m256i upper = _mm256_andnot_si256(_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('Z')),
+		_mm256_cmpgt_epi8(bytes, _mm256_set1_epi8('A' - 1)));
+	return _mm256_or_si256(bytes, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+static FASTCGI_AVX2 const char*
+findStringAvx2(const char *begin, const char *end, const char *str, std::size_t size) {
+	const __m256i first = _mm256_set1_epi8(str[0]);
+	const __m256i last = _mm256_set1_epi8(str[size - 1]);
+	for (; static_cast<std::size_t>(end - begin) >= size + 31; begin += 32) {
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(first, loadAvx2(begin)), _mm256_cmpeq_epi8(last, loadAvx2(begin + size - 1))));
+		while (mask) {
+			const char *candidate = begin + __builtin_ctz(mask);
+			if (0 == memcmp(candidate + 1, str + 1, size - 2)) {
+				return candidate;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return findStringSse2(begin, end, str, size);
+}
+
+static FASTCGI_AVX2 bool
+equalsCIAvx2(const char *lhs, const char *rhs, std::size_t size) {
+	for (; size >= 32; lhs += 32, rhs += 32, size -= 32) {
+		const __m256i equal = _mm256_cmpeq_epi8(foldCaseAvx2(loadAvx2(lhs)), foldCaseAvx2(loadAvx2(rhs)));
+		if (0xFFFFFFFFu != static_cast<unsigned int>(_mm256_movemask_epi8(equal))) {
+			return false;
+		}
+	}
+	return equalsCISse2(lhs, rhs, size);
+}
+
+static FASTCGI_AVX2 const char*
+findEscapeAvx2(const char *begin, const char *end) {
+	for (; end - begin >= 32; begin += 32) {
+		unsigned int mask = escapeMaskAvx2(loadAvx2(begin));
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findEscapeSse2(begin, end);
+}
+
+static FASTCGI_AVX2 const char*
+findUnsafeAvx2(const char *begin, const char *end) {
+	for (; end - begin >= 32; begin += 32) {
+		unsigned int mask = unsafeMaskAvx2(loadAvx2(begin));
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findUnsafeSse2(begin, end);
+}
+
+static FASTCGI_AVX2 std::size_t
+countUnsafeAvx2(const char *begin, const char *end) {
+	std::size_t count = 0;
+	for (; end - begin >= 32; begin += 32) {
+		count += __builtin_popcount(unsafeMaskAvx2(loadAvx2(begin)));
+	}
+	return count + countUnsafeSse2(begin, end);
+}
+
+#undef FASTCGI_AVX2
+
+#endif
+
+#endif // __SSE2__
+
+static SearchKernels
+selectSearchKernels() {
+#ifdef FASTCGI_HAVE_AVX2_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		SearchKernels kernels = { findStringAvx2, equalsCIAvx2, findEscapeAvx2, findUnsafeAvx2, countUnsafeAvx2 };
+		return kernels;
+	}
+#endif
+#ifdef __SSE2__
+	SearchKernels kernels = { findStringSse2, equalsCISse2, findEscapeSse2, findUnsafeSse2, countUnsafeSse2 };
+#else
+	SearchKernels kernels = { findStringScalar, equalsCIScalar, findEscapeScalar, findUnsafeScalar,
+		countUnsafeScalar };
+#endif
+	return kernels;
+}
+
+static const SearchKernels&
+searchKernels() {
+	static const SearchKernels kernels = selectSearchKernels();
+	return kernels;
+}
+
+const char*
+ByteSearch::find(const char *begin, const char *end, const char *str, std::size_t size) {
+	if (size > static_cast<std::size_t>(end - begin)) {
+		return end;
+	}
+	// an empty substring is found at once, as with std::search
+	if (size < 2) {
+		return size ? find(begin, end, str[0]) : begin;
+	}
+	return searchKernels().findString(begin, end, str, size);
+}
+
+bool
+ByteSearch::equalsCI(const char *lhs, const char *rhs, std::size_t size) {
+	return searchKernels().equalsCI(lhs, rhs, size);
+}
+
+const char*
+ByteSearch::findEscape(const char *begin, const char *end) {
+	return searchKernels().findEscape(begin, end);
+}
+
+const char*
+ByteSearch::findUnsafe(const char *begin, const char *end) {
+	return searchKernels().findUnsafe(begin, end);
+}
+
+std::size_t
+ByteSearch::countUnsafe(const char *begin, const char *end) {
+	return searchKernels().countUnsafe(begin, end);
+}
+
+} // namespace fastcgi
@@ -0,0 +1,228 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "fastcgi2/util.h"
+
+#include "details/chunked_buffer.h"
+#include "details/mpmc_ring.h"
+#include "details/range.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+const std::size_t ChunkedBuffer::BLOCK_SIZE;
+
+static const std::size_t MAX_POOLED_BLOCKS = 256;
+
+static MpmcRing<char*>&
+blockPool() {
+	static MpmcRing<char*> pool(MAX_POOLED_BLOCKS);
+	return pool;
+}
+
+static char*
+acquireBlock() {
+	char *block = NULL;
+	if (blockPool().pop(block)) {
+		return block;
+	}
+	block = static_cast<char*>(malloc(ChunkedBuffer::BLOCK_SIZE));
+	if (NULL == block) {
+		throw std::bad_alloc();
+	}
+	return block;
+}
+
+static void
+releaseBlock(char *block) {
+	if (!blockPool().push(std::move(block))) {
+		free(block);
+	}
+}
+
+class ChunkedBuffer::Blocks : private boost::noncopyable {
+public:
+	Blocks() : size_(0)
+	{}
+
+	~Blocks() {
+		for (std::vector<char*>::iterator i = blocks_.begin(); i != blocks_.end(); ++i) {
+			releaseBlock(*i);
+		}
+	}
+
+	void resize(boost::uint64_t size) {
+		const std::size_t count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		blocks_.reserve(count);
+		while (blocks_.size() < count) {
+			blocks_.push_back(acquireBlock());
+		}
+		while (blocks_.size() > count) {
+			releaseBlock(blocks_.back());
+			blocks_.pop_back();
+		}
+		size_ = size;
+	}
+
+	char* at(boost::uint64_t pos) const {
+		return blocks_[pos / BLOCK_SIZE] + pos % BLOCK_SIZE;
+	}
+
+	boost::uint64_t size() const {
+		return size_;
+	}
+
+private:
+	std::vector<char*> blocks_;
+	boost::uint64_t size_;
+};
+
+ChunkedBuffer::ChunkedBuffer(boost::uint64_t size) :
+	blocks_(new Blocks())
+{
+	blocks_->resize(size);
+}
+
+ChunkedBuffer::~ChunkedBuffer()
+{}
+
+boost::uint64_t
+ChunkedBuffer::read(boost::uint64_t pos, char *data, boost::uint64_t len) {
+	for (boost::uint64_t left = len; left; ) {
+		std::pair<char*, boost::uint64_t> part = chunk(pos);
+		const boost::uint64_t size = std::min(part.second, left);
+		memcpy(data, part.first, size);
+		data += size;
+		pos += size;
+		left -= size;
+	}
+	return len;
+}
+
+boost::uint64_t
+ChunkedBuffer::write(boost::uint64_t pos, const char *data, boost::uint64_t len) {
+	for (boost::uint64_t left = len; left; ) {
+		std::pair<char*, boost::uint64_t> part = chunk(pos);
+		const boost::uint64_t size = std::min(part.second, left);
+		memcpy(part.first, data, size);
+		data += size;
+		pos += size;
+		left -= size;
+	}
+	return len;
+}
+
+char
+ChunkedBuffer::at(boost::uint64_t pos) {
+	if (pos >= blocks_->size()) {
+		throw std::out_of_range("Incorrect index");
+	}
+	return *blocks_->at(pos);
+}
+
+bool
+ChunkedBuffer::equals(boost::uint64_t pos, const char *buf, boost::uint64_t len) const {
+	while (len) {
+		std::pair<char*, boost::uint64_t> part = chunk(pos);
+		const boost::uint64_t size = std::min(part.second, len);
+		if (0 != memcmp(part.first, buf, size)) {
+			return false;
+		}
+		buf += size;
+		pos += size;
+		len -= size;
+	}
+	return true;
+}
+
+boost::uint64_t
+ChunkedBuffer::find(boost::uint64_t begin, boost::uint64_t end, const char* buf, boost::uint64_t len) {
+	if (len > end - begin) {
+		return end;
+	}
+	const Range substr(buf, buf + len);
+	for (boost::uint64_t pos = begin; pos < end; ) {
+		const boost::uint64_t segment_end = std::min(segment(pos).second, end);
+
+		// a match that lies within the segment comes before any that starts
+		// in it and crosses into the next one
+		const char *first = blocks_->at(pos);
+		const Range base(first, first + (segment_end - pos));
+		const char *found = base.find(substr);
+		if (found != base.end()) {
+			return pos + (found - first);
+		}
+
+		const boost::uint64_t last = end - len;
+		for (boost::uint64_t cross = std::max(pos, segment_end - std::min(segment_end - pos, len - 1));
+			 cross < segment_end && cross <= last;
+			 ++cross) {
+			if (*blocks_->at(cross) == buf[0] && equals(cross, buf, len)) {
+				return cross;
+			}
+		}
+		pos = segment_end;
+	}
+	return end;
+}
+
+std::pair<boost::uint64_t, boost::uint64_t>
+ChunkedBuffer::trim(boost::uint64_t begin, boost::uint64_t end) const {
+	while (begin != end && isspace(*blocks_->at(begin))) {
+		++begin;
+	}
+	while (begin != end && isspace(*blocks_->at(end - 1))) {
+		--end;
+	}
+	return std::pair<boost::uint64_t, boost::uint64_t>(begin, end);
+}
+
+std::pair<char*, boost::uint64_t>
+ChunkedBuffer::chunk(boost::uint64_t pos) const {
+	if (pos >= blocks_->size()) {
+		return std::pair<char*, boost::uint64_t>(NULL, 0);
+	}
+	std::pair<boost::uint64_t, boost::uint64_t> seg = segment(pos);
+	return std::pair<char*, boost::uint64_t>(blocks_->at(pos), seg.second - pos);
+}
+
+std::pair<boost::uint64_t, boost::uint64_t>
+ChunkedBuffer::segment(boost::uint64_t pos) const {
+	const boost::uint64_t segment_end = (pos / BLOCK_SIZE + 1) * BLOCK_SIZE;
+	return std::pair<boost::uint64_t, boost::uint64_t>(pos, std::min(segment_end, blocks_->size()));
+}
+
+boost::uint64_t
+ChunkedBuffer::size() const {
+	return blocks_->size();
+}
+
+void
+ChunkedBuffer::resize(boost::uint64_t size) {
+	blocks_->resize(size);
+}
+
+const std::string&
+ChunkedBuffer::filename() const {
+	return StringUtils::EMPTY_STRING;
+}
+
+DataBufferImpl*
+ChunkedBuffer::getCopy() const {
+	return new ChunkedBuffer(*this);
+}
+
+} // namespace fastcgi
@@ -0,0 +1,126 @@
+#include "settings.h"
+
+#include "details/cpu_set.h"
+
+#include <pthread.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/lexical_cast.hpp>
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static unsigned int
+parseCpu(const std::string &value, const std::string &list) {
+	try {
+		const unsigned int cpu = boost::lexical_cast<unsigned int>(value);
+		if (cpu < CPU_SETSIZE) {
+			return cpu;
+		}
+	}
+	catch (const boost::bad_lexical_cast&) {
+	}
+	throw std::runtime_error("bad cpu list: " + list);
+}
+
+CpuSet::CpuSet() {
+	CPU_ZERO(&set_);
+}
+
+CpuSet
+CpuSet::parse(const std::string &list) {
+	CpuSet result;
+	std::stringstream stream(list);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		item.erase(0, item.find_first_not_of(" \t\n"));
+		item.erase(item.find_last_not_of(" \t\n") + 1);
+		if (item.empty()) {
+			continue;
+		}
+		const std::string::size_type dash = item.find('-');
+		const unsigned int first = parseCpu(item.substr(0, dash), list);
+		const unsigned int last = std::string::npos == dash ? first : parseCpu(item.substr(dash + 1), list);
+		if (last < first) {
+			throw std::runtime_error("bad cpu list: " + list);
+		}
+		for (unsigned int cpu = first; cpu <= last; ++cpu) {
+			CPU_SET(cpu, &result.set_);
+		}
+	}
+	return result;
+}
+
+CpuSet
+CpuSet::numaNode(unsigned int node) {
+	const std::string path = "/sys/devices/system/node/node" +
+		boost::lexical_cast<std::string>(node) + "/cpulist";
+	std::ifstream file(path.c_str());
+	std::string list;
+	if (!std::getline(file, list)) {
+		throw std::runtime_error("cannot find numa node " + boost::lexical_cast<std::string>(node));
+	}
+	return parse(list);
+}
+
+bool
+CpuSet::empty() const {
+	return 0 == count();
+}
+
+unsigned int
+CpuSet::count() const {
+	return CPU_COUNT(&set_);
+}
+
+void
+CpuSet::merge(const CpuSet &other) {
+	CPU_OR(&set_, &set_, &other.set_);
+}
+
+void
+CpuSet::intersect(const CpuSet &other) {
+	CPU_AND(&set_, &set_, &other.set_);
+}
+
+void
+CpuSet::apply() const {
+	const int res = pthread_setaffinity_np(pthread_self(), sizeof(set_), &set_);
+	if (0 != res) {
+		throw std::runtime_error("cannot bind thread to cpus " + toString() + ": " + strerror(res));
+	}
+}
+
+std::string
+CpuSet::toString() const {
+	std::string result;
+	for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (!CPU_ISSET(cpu, &set_)) {
+			continue;
+		}
+		unsigned int last = cpu;
+		while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set_)) {
+			++last;
+		}
+		if (!result.empty()) {
+			result.push_back(',');
+		}
+		result += boost::lexical_cast<std::string>(cpu);
+		if (last != cpu) {
+			result += "-" + boost::lexical_cast<std::string>(last);
+		}
+		cpu = last;
+	}
+	return result;
+}
+
+} // namespace fastcgi
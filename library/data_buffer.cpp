@@ -1,10 +1,13 @@
 #include "settings.h"
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 #include "fastcgi2/data_buffer.h"
 #include "fastcgi2/util.h"
 
+#include "details/byte_search.h"
 #include "details/data_buffer_impl.h"
 #include "details/string_buffer.h"
 
@@ -15,6 +18,23 @@
 namespace fastcgi
 {
 
+// compares data with the storage at pos a segment at a time
+static bool
+equals(const DataBuffer &buffer, boost::uint64_t pos, const std::string &data, bool ignoreCase) {
+	const char *str = data.data();
+	for (boost::uint64_t left = data.size(); left; ) {
+		std::pair<char*, boost::uint64_t> part = buffer.impl()->chunk(pos);
+		const boost::uint64_t size = std::min(part.second, left);
+		if (ignoreCase ? !ByteSearch::equalsCI(part.first, str, size) : 0 != memcmp(part.first, str, size)) {
+			return false;
+		}
+		str += size;
+		pos += size;
+		left -= size;
+	}
+	return true;
+}
+
 DataBuffer::DataBuffer() : begin_(0), end_(0)
 {}
 
@@ -96,6 +116,15 @@ DataBuffer::resize(boost::uint64_t size) {
 	end_ = begin_ + size;
 }
 
+const std::string&
+DataBuffer::filename() const {
+	// a slice is not the whole file, renaming the file would keep the rest as well
+	if (isNil() || 0 != begin_ || data_->size() != end_) {
+		return StringUtils::EMPTY_STRING;
+	}
+	return data_->filename();
+}
+
 DataBufferImpl*
 DataBuffer::impl() const {
 	return data_.get();
@@ -182,60 +211,22 @@ DataBuffer::split(char delim, DataBuffer &first, DataBuffer &second) const {
 
 bool
 DataBuffer::startsWith(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	if (data_size > size()) {
-		return false;
-	}
-	for (boost::uint64_t i = 0; i < data_size; ++i) {
-		if (data[i] != at(i)) {
-			return false;
-		}
-	}
-	return true;
+	return data.size() <= size() && equals(*this, begin_, data, false);
 }
 
 bool
 DataBuffer::startsWithCI(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	if (data_size > size()) {
-		return false;
-	}
-	for (boost::uint64_t i = 0; i < data_size; ++i) {
-		if (tolower(data[i]) != tolower(at(i))) {
-			return false;
-		}
-	}
-	return true;
+	return data.size() <= size() && equals(*this, begin_, data, true);
 }
 
 bool
 DataBuffer::endsWith(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	boost::uint64_t sz = size();
-	if (data_size > sz) {
-		return false;
-	}
-	for (boost::uint64_t i = 1; i <= data_size; ++i) {
-		if (data[data_size - i] != at(sz - i)) {
-			return false;
-		}
-	}
-	return true;
+	return data.size() <= size() && equals(*this, end_ - data.size(), data, false);
 }
 
 bool
 DataBuffer::endsWithCI(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	boost::uint64_t sz = size();
-	if (data_size > sz) {
-		return false;
-	}
-	for (boost::uint64_t i = 1; i <= data_size; ++i) {
-		if (tolower(data[data_size - i]) != tolower(at(sz - i))) {
-			return false;
-		}
-	}
-	return true;
+	return data.size() <= size() && equals(*this, end_ - data.size(), data, true);
 }
 
 DataBuffer::SegmentIterator
@@ -259,35 +250,34 @@ DataBuffer::toString(std::string &str) const {
 }
 
 DataBuffer::SegmentIterator::SegmentIterator() :
-	pos_begin_(0), pos_end_(0), data_(std::pair<char*, boost::uint64_t>(NULL, 0))
+	impl_(NULL), pos_begin_(0), pos_end_(0), end_(0), data_(std::pair<char*, boost::uint64_t>(NULL, 0))
 {}
 
 DataBuffer::SegmentIterator::SegmentIterator(const DataBuffer &buffer) :
-	buffer_(buffer), pos_begin_(buffer.begin_)
+	impl_(NULL), pos_begin_(0), pos_end_(0), end_(0)
 {
-	if (buffer_.empty()) {
-		buffer_ = DataBuffer();
-		pos_begin_ = 0;
-		pos_end_ = 0;
+	if (buffer.empty()) {
 		return;
 	}
-	buffer_.data_ = boost::shared_ptr<DataBufferImpl>(buffer.data_->getCopy());
-	std::pair<boost::uint64_t, boost::uint64_t> segment = buffer_.data_->segment(pos_begin_);
-	pos_end_ = std::min(segment.second, buffer_.end_);
+	impl_ = buffer.data_.get();
+	pos_begin_ = buffer.begin_;
+	end_ = buffer.end_;
+	std::pair<boost::uint64_t, boost::uint64_t> segment = impl_->segment(pos_begin_);
+	pos_end_ = std::min(segment.second, end_);
 }
 
 DataBufferImpl*
 DataBuffer::SegmentIterator::impl() const {
-	return buffer_.data_.get();
+	return impl_;
 }
 
 std::pair<char*, boost::uint64_t>
 DataBuffer::SegmentIterator::operator*() const {
-	if (*this == SegmentIterator()) {
+	if (NULL == impl_) {
 		return std::pair<char*, boost::uint64_t>(NULL, 0);
 	}
-	std::pair<char*, boost::uint64_t> res = buffer_.data_->chunk(pos_begin_);
-	res.second = std::min(res.second, buffer_.end_ - pos_begin_);
+	std::pair<char*, boost::uint64_t> res = impl_->chunk(pos_begin_);
+	res.second = std::min(res.second, end_ - pos_begin_);
 	return res;
 }
 
@@ -299,20 +289,18 @@ DataBuffer::SegmentIterator::operator->() const {
 
 DataBuffer::SegmentIterator&
 DataBuffer::SegmentIterator::operator++() {
-	if (*this == SegmentIterator()) {
+	if (NULL == impl_) {
 		return *this;
 	}
 
-	if (pos_end_ >= buffer_.end_) {
-		buffer_ = DataBuffer();
-		pos_begin_ = 0;
-		pos_end_ = 0;
+	if (pos_end_ >= end_) {
+		*this = SegmentIterator();
 		return *this;
 	}
 
-	std::pair<boost::uint64_t, boost::uint64_t> segment = buffer_.data_->segment(pos_end_);
+	std::pair<boost::uint64_t, boost::uint64_t> segment = impl_->segment(pos_end_);
 	pos_begin_ = pos_end_;
-	pos_end_ = std::min(segment.second, buffer_.end_);
+	pos_end_ = std::min(segment.second, end_);
 	return *this;
 }
 
@@ -0,0 +1,306 @@
+#include "settings.h"
+
+#include <strings.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "fastcgi2/util.h"
+
+#include "details/env_map.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static constexpr boost::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static constexpr boost::uint64_t FNV_PRIME = 1099511628211ULL;
+
+static constexpr unsigned int KNOWN_SLOTS_BITS = 6;
+static const std::size_t MIN_UNKNOWN_CAPACITY = 16;
+
+// FNV-1a of the name with the case of letters folded
+static inline boost::uint64_t
+foldedHash(const char *key, std::size_t size) {
+	boost::uint64_t hash = FNV_OFFSET_BASIS;
+	for (const char *end = key + size; key != end; ++key) {
+		hash = (hash ^ (static_cast<unsigned char>(*key) | 0x20)) * FNV_PRIME;
+	}
+	return hash;
+}
+
+// the same hash of a literal at compile time
+static constexpr boost::uint64_t
+literalHash(const char *key, boost::uint64_t hash) {
+	return *key ? literalHash(key + 1, (hash ^ (static_cast<unsigned char>(*key) | 0x20)) * FNV_PRIME) : hash;
+}
+
+static constexpr const char* KNOWN_NAMES[EnvMap::KEYS_COUNT] = {
+	"SERVER_PORT", "SERVER_ADDR", "PATH_INFO", "PATH_TRANSLATED", "SCRIPT_NAME", "SCRIPT_FILENAME", "DOCUMENT_ROOT",
+	"REMOTE_USER", "REMOTE_ADDR", "QUERY_STRING", "REQUEST_METHOD", "REQUEST_ID", "HTTPS",
+	"HOST", "CONTENT-TYPE", "CONTENT-LENGTH"
+};
+
+static constexpr std::size_t
+knownSlot(boost::uint64_t hash) {
+	return hash >> (64 - KNOWN_SLOTS_BITS);
+}
+
+static constexpr bool
+distinctSlots(std::size_t i, std::size_t j) {
+	return i + 1 >= EnvMap::KEYS_COUNT ? true :
+		j >= EnvMap::KEYS_COUNT ? distinctSlots(i + 1, i + 2) :
+		knownSlot(literalHash(KNOWN_NAMES[i], FNV_OFFSET_BASIS)) != knownSlot(literalHash(KNOWN_NAMES[j], FNV_OFFSET_BASIS)) &&
+			distinctSlots(i, j + 1);
+}
+
+static_assert(distinctSlots(0, 1), "well known names must have distinct slots");
+
+class KnownSlots {
+public:
+	KnownSlots() {
+		std::fill(slots_, slots_ + (1 << KNOWN_SLOTS_BITS), EnvMap::KEYS_COUNT);
+		for (int key = 0; key < EnvMap::KEYS_COUNT; ++key) {
+			sizes_[key] = strlen(KNOWN_NAMES[key]);
+			slots_[knownSlot(foldedHash(KNOWN_NAMES[key], sizes_[key]))] = static_cast<EnvMap::Key>(key);
+		}
+	}
+
+	EnvMap::Key operator [] (boost::uint64_t hash) const {
+		return slots_[knownSlot(hash)];
+	}
+
+	std::size_t size(EnvMap::Key key) const {
+		return sizes_[key];
+	}
+
+private:
+	EnvMap::Key slots_[1 << KNOWN_SLOTS_BITS];
+	std::size_t sizes_[EnvMap::KEYS_COUNT];
+};
+
+static const KnownSlots knownSlots;
+
+EnvMap::EnvMap(Buffer &buffer, bool ignoreCase) :
+	buffer_(buffer), ignoreCase_(ignoreCase), entries_(buffer.get_allocator()),
+	unknown_(buffer.get_allocator()), stringsUsed_(0)
+{
+	std::fill(known_, known_ + KEYS_COUNT, NPOS);
+}
+
+void
+EnvMap::add(const Range &key, const Range &value) {
+	add(key, AS_IS, value, AS_IS);
+}
+
+void
+EnvMap::add(const Range &key, Conversion keyConversion, const Range &value, Conversion valueConversion) {
+	Entry entry;
+	entry.keyOffset = buffer_.size();
+	entry.keySize = copy(key, keyConversion);
+	entry.valueOffset = buffer_.size();
+	entry.valueSize = copy(value, valueConversion);
+	entry.string = NPOS;
+
+	const char *name = buffer_.data() + entry.keyOffset;
+	entry.hash = foldedHash(name, entry.keySize);
+	const Key knownKey = known(name, entry.keySize, entry.hash);
+	const std::size_t index = (KEYS_COUNT != knownKey) ?
+		known_[knownKey] : findUnknown(name, entry.keySize, entry.hash);
+	if (NPOS == index) {
+		entries_.push_back(entry);
+		if (KEYS_COUNT != knownKey) {
+			known_[knownKey] = entries_.size() - 1;
+		}
+		else {
+			insertUnknown(entries_.size() - 1);
+		}
+		return;
+	}
+
+	// the old value and its string stay where they are, references to them remain valid
+	entries_[index].valueOffset = entry.valueOffset;
+	entries_[index].valueSize = entry.valueSize;
+	entries_[index].string = NPOS;
+}
+
+bool
+EnvMap::has(const std::string &key) const {
+	return NPOS != find(key.data(), key.size());
+}
+
+const std::string&
+EnvMap::get(const std::string &key) const {
+	return string(find(key.data(), key.size()));
+}
+
+bool
+EnvMap::has(Key key) const {
+	return NPOS != known_[key];
+}
+
+const std::string&
+EnvMap::get(Key key) const {
+	return string(known_[key]);
+}
+
+const std::string&
+EnvMap::string(std::size_t index) const {
+	if (NPOS == index) {
+		return StringUtils::EMPTY_STRING;
+	}
+
+	const Entry &entry = entries_[index];
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (NPOS == entry.string) {
+		if (strings_.size() == stringsUsed_) {
+			strings_.push_back(std::string());
+		}
+		strings_[stringsUsed_].assign(buffer_.data() + entry.valueOffset, entry.valueSize);
+		entry.string = stringsUsed_++;
+	}
+	return strings_[entry.string];
+}
+void
+EnvMap::keys(std::vector<std::string> &v) const {
+	std::vector<std::string> tmp;
+	tmp.reserve(entries_.size());
+	for (EntryVector::const_iterator i = entries_.begin(), end = entries_.end(); i != end; ++i) {
+		tmp.push_back(std::string(buffer_.data() + i->keyOffset, i->keySize));
+	}
+	v.swap(tmp);
+}
+
+std::size_t
+EnvMap::size() const {
+	return entries_.size();
+}
+
+Range
+EnvMap::key(std::size_t index) const {
+	const char *begin = buffer_.data() + entries_[index].keyOffset;
+	return Range(begin, begin + entries_[index].keySize);
+}
+
+Range
+EnvMap::value(std::size_t index) const {
+	const char *begin = buffer_.data() + entries_[index].valueOffset;
+	return Range(begin, begin + entries_[index].valueSize);
+}
+
+void
+EnvMap::reserve(std::size_t size) {
+	entries_.reserve(size);
+	if (unknown_.size() < 2 * size) {
+		rehash(2 * size);
+	}
+}
+
+void
+EnvMap::clear() {
+	EntryVector(entries_.get_allocator()).swap(entries_);
+	IndexVector(unknown_.get_allocator()).swap(unknown_);
+	std::fill(known_, known_ + KEYS_COUNT, NPOS);
+	stringsUsed_ = 0;
+}
+
+std::size_t
+EnvMap::copy(const Range &range, Conversion conversion) {
+	const std::size_t offset = buffer_.size();
+	buffer_.resize(offset + range.size());
+	char *begin = buffer_.data() + offset;
+	if (URLDECODE == conversion) {
+		buffer_.resize(StringUtils::urldecode(range, begin) - buffer_.data());
+		return buffer_.size() - offset;
+	}
+	std::copy(range.begin(), range.end(), begin);
+	if (HEADER_NAME == conversion) {
+		std::replace(begin, begin + range.size(), '_', '-');
+	}
+	return range.size();
+}
+
+EnvMap::Key
+EnvMap::known(const char *key, std::size_t size, boost::uint64_t hash) const {
+	const Key result = knownSlots[hash];
+	if (KEYS_COUNT == result) {
+		return KEYS_COUNT;
+	}
+	const char *name = KNOWN_NAMES[result];
+	if (size != knownSlots.size(result)) {
+		return KEYS_COUNT;
+	}
+	return (ignoreCase_ ? 0 == strncasecmp(name, key, size) : 0 == memcmp(name, key, size)) ? result : KEYS_COUNT;
+}
+
+std::size_t
+EnvMap::find(const char *key, std::size_t size) const {
+	const boost::uint64_t hash = foldedHash(key, size);
+	const Key knownKey = known(key, size, hash);
+	return (KEYS_COUNT != knownKey) ? known_[knownKey] : findUnknown(key, size, hash);
+}
+
+std::size_t
+EnvMap::findUnknown(const char *key, std::size_t size, boost::uint64_t hash) const {
+	if (unknown_.empty()) {
+		return NPOS;
+	}
+	const std::size_t mask = unknown_.size() - 1;
+	for (std::size_t slot = hash & mask; 0 != unknown_[slot]; slot = (slot + 1) & mask) {
+		const Entry &entry = entries_[unknown_[slot] - 1];
+		if (entry.hash == hash && equal(entry, key, size)) {
+			return unknown_[slot] - 1;
+		}
+	}
+	return NPOS;
+}
+
+void
+EnvMap::insertUnknown(std::size_t index) {
+	// the index is kept at most half full
+	if (2 * entries_.size() > unknown_.size()) {
+		rehash(std::max(2 * unknown_.size(), MIN_UNKNOWN_CAPACITY));
+	}
+	const std::size_t mask = unknown_.size() - 1;
+	std::size_t slot = entries_[index].hash & mask;
+	while (0 != unknown_[slot]) {
+		slot = (slot + 1) & mask;
+	}
+	unknown_[slot] = index + 1;
+}
+
+void
+EnvMap::rehash(std::size_t capacity) {
+	std::size_t size = MIN_UNKNOWN_CAPACITY;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	IndexVector tmp(size, 0, unknown_.get_allocator());
+	const std::size_t mask = size - 1;
+	for (std::size_t i = 0; i < unknown_.size(); ++i) {
+		if (0 == unknown_[i]) {
+			continue;
+		}
+		std::size_t slot = entries_[unknown_[i] - 1].hash & mask;
+		while (0 != tmp[slot]) {
+			slot = (slot + 1) & mask;
+		}
+		tmp[slot] = unknown_[i];
+	}
+	unknown_.swap(tmp);
+}
+
+bool
+EnvMap::equal(const Entry &entry, const char *key, std::size_t size) const {
+	if (entry.keySize != size) {
+		return false;
+	}
+	const char *name = buffer_.data() + entry.keyOffset;
+	return ignoreCase_ ? 0 == strncasecmp(name, key, size) : 0 == memcmp(name, key, size);
+}
+
+} // namespace fastcgi
@@ -1,11 +1,14 @@
 #include "settings.h"
 
+#include <boost/lexical_cast.hpp>
+
 #include "fastcgi2/component.h"
 #include "fastcgi2/config.h"
 #include "fastcgi2/handler.h"
 #include "fastcgi2/logger.h"
 
 #include "details/componentset.h"
+#include "details/cpu_set.h"
 #include "details/globals.h"
 #include "details/handlerset.h"
 #include "details/loader.h"
@@ -18,6 +21,9 @@
 namespace fastcgi
 {
 
+static const int DEFAULT_POOL_IDLE_TIMEOUT = 60;
+static const int MAX_POOL_PRIORITIES = 16;
+
 Globals::Globals(const Config *config) : config_(config), loader_(new Loader()),
 	handlerSet_(new HandlerSet()), componentSet_(new ComponentSet()), logger_(NULL)
 {
@@ -104,9 +110,28 @@ Globals::initPools() {
     unsigned maxTasksInProcessCounter = 0;
     for (std::vector<std::string>::const_iterator p = poolSubkeys.begin(); p != poolSubkeys.end(); ++p) {
         const std::string poolName = config_->asString(*p + "/@name");
-        const int threadsNumber = config_->asInt(*p + "/@threads");
+        const int threadsNumber = config_->asInt(*p + "/@max-threads", config_->asInt(*p + "/@threads", 0));
+        const int minThreadsNumber = config_->asInt(*p + "/@min-threads", threadsNumber);
+        const int idleTimeout = config_->asInt(*p + "/@idle-timeout", DEFAULT_POOL_IDLE_TIMEOUT);
         const int queueLength = config_->asInt(*p + "/@queue");
         const int delay = config_->asInt(*p + "/@max-delay", 0);
+        const int spinTime = config_->asInt(*p + "/@spin", 0);
+        const std::string cpus = config_->asString(*p + "/@cpus", "");
+        const int numaNode = config_->asInt(*p + "/@numa-node", -1);
+        const int priorities = config_->asInt(*p + "/@priorities", 1);
+        const int lifoThreshold = config_->asInt(*p + "/@lifo-threshold", 0);
+        const std::string priorityHeader = config_->asString(*p + "/@priority-header", "");
+
+		if (threadsNumber <= 0) {
+			throw std::runtime_error(poolName + ": pool must have threads or max-threads attribute");
+		}
+		if (minThreadsNumber <= 0 || minThreadsNumber > threadsNumber) {
+			throw std::runtime_error(poolName + ": min-threads must be between 1 and max-threads");
+		}
+		if (priorities <= 0 || priorities > MAX_POOL_PRIORITIES) {
+			throw std::runtime_error(poolName + ": priorities must be between 1 and "
+				+ boost::lexical_cast<std::string>(MAX_POOL_PRIORITIES));
+		}
 
 		maxTasksInProcessCounter += (threadsNumber + queueLength);
 		if (maxTasksInProcessCounter > 65535) {
@@ -121,9 +146,28 @@ Globals::initPools() {
 			continue;
 		}
 
-		pools_.insert(make_pair(poolName, boost::shared_ptr<RequestsThreadPool>(delay ?
-				new RequestsThreadPool(threadsNumber, queueLength, delay, logger_) :
-				new RequestsThreadPool(threadsNumber, queueLength, logger_))));
+		ThreadPoolSettings settings;
+		settings.threadsNumber = threadsNumber;
+		settings.minThreadsNumber = minThreadsNumber;
+		settings.idleTimeout = idleTimeout > 0 ? idleTimeout * 1000 : 0;
+		settings.queueLength = queueLength;
+		settings.spinTime = spinTime > 0 ? spinTime : 0;
+		settings.priorities = priorities;
+		settings.lifoThreshold = lifoThreshold > 0 ? lifoThreshold : 0;
+		settings.cpus = CpuSet::parse(cpus);
+		if (numaNode >= 0) {
+			CpuSet nodeCpus = CpuSet::numaNode(numaNode);
+			if (!settings.cpus.empty()) {
+				nodeCpus.intersect(settings.cpus);
+			}
+			settings.cpus = nodeCpus;
+			if (settings.cpus.empty()) {
+				throw std::runtime_error(poolName + ": cpus do not belong to numa node " + boost::lexical_cast<std::string>(numaNode));
+			}
+		}
+
+		pools_.insert(make_pair(poolName, boost::shared_ptr<RequestsThreadPool>(
+				new RequestsThreadPool(settings, delay, priorityHeader, logger_))));
     }
 
     for (std::set<std::string>::const_iterator i = poolsNeeded.begin(); i != poolsNeeded.end(); ++i) {
@@ -12,6 +12,15 @@ namespace fastcgi
 
 HandlerContext::~HandlerContext() {
 }
+
+Arena*
+HandlerContext::arena() const {
+	return NULL;
+}
+
+HandlerContextImpl::HandlerContextImpl(Arena *arena) :
+	arena_(arena)
+{}
 	
 boost::any HandlerContextImpl::getParam(const std::string &name) const {
 	ParamsMapType::const_iterator itr = params_.find(name);
@@ -24,6 +33,11 @@ boost::any HandlerContextImpl::getParam(const std::string &name) const {
 void HandlerContextImpl::setParam(const std::string &name, const boost::any &value) {
 	params_[name] = value;
 }
+
+Arena*
+HandlerContextImpl::arena() const {
+	return arena_;
+}
 	
 Handler::Handler() {
 }
@@ -1,5 +1,7 @@
 #include "settings.h"
 
+#include <algorithm>
+
 #include <boost/lexical_cast.hpp>
 
 #include "details/handlerset.h"
@@ -33,6 +35,13 @@ HandlerSet::init(const Config *config, const ComponentSet *componentSet) {
         HandlerDescription handlerDesc;
         handlerDesc.poolName = config->asString(*k + "/@pool");
         handlerDesc.id = config->asString(*k + "/@id", "");
+        handlerDesc.priority = std::max(config->asInt(*k + "/@priority", 0), 0);
+
+        const std::string body = config->asString(*k + "/@body", "buffer");
+        if ("buffer" != body && "stream" != body) {
+            throw std::runtime_error("Unknown body mode of handler: " + body);
+        }
+        handlerDesc.streamBody = "stream" == body;
 
         std::string url_filter = config->asString(*k + "/@url", "");
         if (!url_filter.empty()) {
@@ -99,6 +108,28 @@ HandlerSet::init(const Config *config, const ComponentSet *componentSet) {
     }
 }
 
+bool
+HandlerSet::hasStreamBodies() const {
+    for (HandlerArray::const_iterator i = handlers_.begin(); i != handlers_.end(); ++i) {
+        if (i->streamBody) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const HandlerSet::HandlerDescription*
+HandlerSet::findParamHandler() const {
+    for (HandlerArray::const_iterator i = handlers_.begin(); i != handlers_.end(); ++i) {
+        for (HandlerDescription::FilterArray::const_iterator f = i->filters.begin(); f != i->filters.end(); ++f) {
+            if ("param" == f->first) {
+                return &*i;
+            }
+        }
+    }
+    return NULL;
+}
+
 const HandlerSet::HandlerDescription*
 HandlerSet::findURIHandler(const Request *request) const {
     for (HandlerArray::const_iterator i = handlers_.begin(); i != handlers_.end(); ++i) {
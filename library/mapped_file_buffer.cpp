@@ -0,0 +1,190 @@
+#include "settings.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "details/range.h"
+#include "details/mapped_file_buffer.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static void
+throwError(const std::string &message, const std::string &filename) {
+	char buffer[256];
+	throw std::runtime_error(message + " " + filename + ": " + strerror_r(errno, buffer, sizeof(buffer)));
+}
+
+class MappedFileBuffer::MappedFile : private boost::noncopyable {
+public:
+	MappedFile(const std::string &dir) : fd_(-1), data_(NULL), size_(0) {
+		std::string name = dir + "/fastcgi-body.XXXXXX";
+		std::vector<char> buffer(name.begin(), name.end());
+		buffer.push_back('\0');
+		fd_ = mkostemp(&buffer[0], O_CLOEXEC);
+		if (-1 == fd_) {
+			throwError("cannot create", name);
+		}
+		name_.assign(&buffer[0]);
+	}
+
+	~MappedFile() {
+		unmap();
+		removeIfOwned();
+		close(fd_);
+	}
+
+	void resize(boost::uint64_t size) {
+		unmap();
+		if (-1 == ftruncate(fd_, size)) {
+			throwError("cannot resize", name_);
+		}
+		if (size > size_) {
+			// a write to a sparse page the disk has no room for raises SIGBUS,
+			// so the space is taken now and only this request fails without it
+			const int error = posix_fallocate(fd_, size_, size - size_);
+			if (0 != error) {
+				errno = error;
+				throwError("cannot allocate", name_);
+			}
+		}
+		if (size) {
+			void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+			if (MAP_FAILED == data) {
+				throwError("cannot map", name_);
+			}
+			data_ = static_cast<char*>(data);
+		}
+		size_ = size;
+	}
+
+	char* data() const {
+		return data_;
+	}
+
+	boost::uint64_t size() const {
+		return size_;
+	}
+
+	const std::string& name() const {
+		return name_;
+	}
+
+private:
+	void unmap() {
+		if (data_) {
+			munmap(data_, size_);
+			data_ = NULL;
+		}
+	}
+
+	// the name may have been given to another file after a handler renamed ours
+	void removeIfOwned() {
+		struct stat own, named;
+		if (0 == fstat(fd_, &own) && 0 == stat(name_.c_str(), &named) &&
+			own.st_dev == named.st_dev && own.st_ino == named.st_ino) {
+			unlink(name_.c_str());
+		}
+	}
+
+private:
+	int fd_;
+	char *data_;
+	boost::uint64_t size_;
+	std::string name_;
+};
+
+MappedFileBuffer::MappedFileBuffer(const std::string &dir, boost::uint64_t size) :
+	file_(new MappedFile(dir))
+{
+	file_->resize(size);
+}
+
+MappedFileBuffer::~MappedFileBuffer()
+{}
+
+boost::uint64_t
+MappedFileBuffer::read(boost::uint64_t pos, char *data, boost::uint64_t len) {
+	memcpy(data, file_->data() + pos, len);
+	return len;
+}
+
+boost::uint64_t
+MappedFileBuffer::write(boost::uint64_t pos, const char *data, boost::uint64_t len) {
+	memcpy(file_->data() + pos, data, len);
+	return len;
+}
+
+char
+MappedFileBuffer::at(boost::uint64_t pos) {
+	if (pos >= file_->size()) {
+		throw std::out_of_range("Incorrect index");
+	}
+	return file_->data()[pos];
+}
+
+boost::uint64_t
+MappedFileBuffer::find(boost::uint64_t begin, boost::uint64_t end, const char* buf, boost::uint64_t len) {
+	if (len > end - begin) {
+		return end;
+	}
+	char* first = file_->data();
+	Range base(first + begin, first + end);
+	Range substr(buf, buf + len);
+	return base.find(substr) - first;
+}
+
+std::pair<boost::uint64_t, boost::uint64_t>
+MappedFileBuffer::trim(boost::uint64_t begin, boost::uint64_t end) const {
+	char* first = file_->data();
+	Range base(first + begin, first + end);
+	Range trimmed = base.trim();
+	return std::pair<boost::uint64_t, boost::uint64_t>(
+		trimmed.begin() - first, trimmed.end() - first);
+}
+
+std::pair<char*, boost::uint64_t>
+MappedFileBuffer::chunk(boost::uint64_t pos) const {
+	return std::pair<char*, boost::uint64_t>(file_->data() + pos, file_->size() - pos);
+}
+
+std::pair<boost::uint64_t, boost::uint64_t>
+MappedFileBuffer::segment(boost::uint64_t pos) const {
+	return std::pair<boost::uint64_t, boost::uint64_t>(pos, size());
+}
+
+boost::uint64_t
+MappedFileBuffer::size() const {
+	return file_->size();
+}
+
+void
+MappedFileBuffer::resize(boost::uint64_t size) {
+	file_->resize(size);
+}
+
+const std::string&
+MappedFileBuffer::filename() const {
+	return file_->name();
+}
+
+DataBufferImpl*
+MappedFileBuffer::getCopy() const {
+	return new MappedFileBuffer(*this);
+}
+
+} // namespace fastcgi
@@ -0,0 +1,172 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "details/byte_search.h"
+#include "details/multipart_parser.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+const std::size_t MultipartParser::MAX_HEADERS_SIZE;
+
+MultipartParser::MultipartParser(const std::string &boundary, PartHandler handler) :
+	delimiter_("\n" + boundary), handler_(handler), state_(CONTENT), in_part_(false), part_begin_(0),
+	offset_(0), piece_(NULL), tail_(1, '\n')
+{
+	// the body starts with a boundary without a line feed before it, the
+	// tail holds one that is not in the body to find the first boundary as
+	// any other one
+	window_.reserve(2 * delimiter_.size());
+}
+
+bool
+MultipartParser::finished() const {
+	return FINISHED == state_;
+}
+
+void
+MultipartParser::feed(const char *data, std::size_t size) {
+	piece_ = data;
+	const char *pos = data, *end = data + size;
+	while (pos != end && FINISHED != state_) {
+		switch (state_) {
+			case CONTENT:
+				pos = scanContent(pos, end);
+				break;
+			case BOUNDARY_LINE:
+			case CLOSE:
+				pos = scanBoundaryLine(pos, end);
+				break;
+			case HEADERS:
+				pos = scanHeaders(pos, end);
+				break;
+			case FINISHED:
+				break;
+		}
+	}
+	offset_ += size;
+}
+
+boost::uint64_t
+MultipartParser::offsetOf(const char *pos) const {
+	return offset_ + (pos - piece_);
+}
+
+const char*
+MultipartParser::search(const char *begin, const char *end) const {
+	return ByteSearch::find(begin, end, delimiter_.data(), delimiter_.size());
+}
+
+const char*
+MultipartParser::scanContent(const char *pos, const char *end) {
+	const std::size_t size = delimiter_.size();
+
+	// a delimiter that starts in the tail ends in the first bytes of the piece
+	const std::size_t head = std::min(static_cast<std::size_t>(end - pos), size - 1);
+	window_.assign(tail_);
+	window_.append(pos, head);
+	const char *window_end = window_.data() + window_.size();
+	const char *found = search(window_.data(), window_end);
+	if (found != window_end) {
+		const std::size_t index = found - window_.data();
+		// the offset wraps around for the line feed added before the body,
+		// it is not used for anything then
+		const boost::uint64_t start = offsetOf(pos) - tail_.size() + index;
+		return delimiterFound(start, index ? found[-1] : '\0', pos + (index + size - tail_.size()));
+	}
+
+	found = search(pos, end);
+	if (found != end) {
+		const char prev = (found != pos) ? found[-1] : tail_[tail_.size() - 1];
+		return delimiterFound(offsetOf(found), prev, found + size);
+	}
+
+	if (static_cast<std::size_t>(end - pos) >= size) {
+		tail_.assign(end - size, end);
+	}
+	else {
+		tail_.append(pos, end);
+		if (tail_.size() > size) {
+			tail_.erase(0, tail_.size() - size);
+		}
+	}
+	return end;
+}
+
+const char*
+MultipartParser::delimiterFound(boost::uint64_t start, char prev, const char *next) {
+	if (in_part_) {
+		// the line break before the delimiter belongs to it, a part that is
+		// empty has its delimiter right after the headers
+		boost::uint64_t content_end = part_begin_;
+		if (start > part_begin_) {
+			content_end = ('\r' == prev) ? start - 1 : start;
+		}
+		handler_(Range::fromString(headers_), part_begin_, content_end);
+		in_part_ = false;
+	}
+	tail_.clear();
+	state_ = BOUNDARY_LINE;
+	return next;
+}
+
+const char*
+MultipartParser::scanBoundaryLine(const char *pos, const char *end) {
+	for (; pos != end; ++pos) {
+		const char ch = *pos;
+		if (CLOSE == state_) {
+			if ('-' != ch) {
+				throw std::runtime_error("malformed multipart message");
+			}
+			state_ = FINISHED;
+			return pos + 1;
+		}
+		if ('-' == ch) {
+			state_ = CLOSE;
+		}
+		else if ('\n' == ch) {
+			headers_.clear();
+			state_ = HEADERS;
+			return pos + 1;
+		}
+		else if (' ' != ch && '\t' != ch && '\r' != ch) {
+			throw std::runtime_error("malformed multipart message");
+		}
+	}
+	return end;
+}
+
+const char*
+MultipartParser::scanHeaders(const char *pos, const char *end) {
+	const char *line_end = static_cast<const char*>(memchr(pos, '\n', end - pos));
+	const char *next = line_end ? line_end + 1 : end;
+	if (headers_.size() + (next - pos) > MAX_HEADERS_SIZE) {
+		throw std::runtime_error("too large headers of multipart message part");
+	}
+	headers_.append(pos, next);
+	if (NULL == line_end) {
+		return end;
+	}
+
+	// headers end with an empty line, a part may have no headers at all
+	const std::size_t size = headers_.size();
+	const bool empty_line = (1 == size) || (2 == size && '\r' == headers_[0]) ||
+		(size > 1 && '\n' == headers_[size - 2]) ||
+		(size > 2 && '\r' == headers_[size - 2] && '\n' == headers_[size - 3]);
+	if (empty_line) {
+		in_part_ = true;
+		part_begin_ = offsetOf(next);
+		tail_.assign(1, '\n');
+		state_ = CONTENT;
+	}
+	return next;
+}
+
+} // namespace fastcgi
@@ -13,6 +13,7 @@
 
 #include "details/range.h"
 #include "details/parser.h"
+#include "details/byte_search.h"
 #include "details/requestimpl.h"
 
 #ifdef HAVE_DMALLOC_H
@@ -92,13 +93,30 @@ Parser::addCookie(RequestImpl *req, const Range &range) {
 	Range tmp = range.trim(), head, tail;
 	tmp.split('=', head, tail);
 	if (!head.empty()) {
-		req->cookies_[StringUtils::urldecode(head)] = StringUtils::urldecode(tail);
+		req->cookies_.add(head, EnvMap::URLDECODE, tail, EnvMap::URLDECODE);
 	}
 }
 
 void
 Parser::addHeader(RequestImpl *req, const Range &key, const Range &value) {
-	req->headers_[normalizeInputHeaderName(key)] = value.toString();
+	req->headers_.add(key, EnvMap::HEADER_NAME, value, EnvMap::AS_IS);
+}
+
+void
+Parser::addVariable(RequestImpl *req, const Range &key, const Range &value) {
+	if (COOKIE_RANGE == key) {
+		parseCookies(req, value);
+		addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
+	}
+	else if (CONTENT_TYPE_RANGE == key) {
+		addHeader(req, key, value.trim());
+	}
+	else if (key.startsWith(HEADER_RANGE)) {
+		addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
+	}
+	else {
+		req->vars_.add(key, value);
+	}
 }
 
 void
@@ -107,19 +125,26 @@ Parser::parse(RequestImpl *req, char *env[], Logger* logger) {
 		logger->debug("env[%d] = %s", i, env[i]);
 		Range key, value;
 		Range::fromChars(env[i]).split('=', key, value);
-		if (COOKIE_RANGE == key) {
-			parseCookies(req, value);
-			addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
-		}
-		else if (CONTENT_TYPE_RANGE == key) {
-			addHeader(req, key, value.trim());
-		}
-		else if (key.startsWith(HEADER_RANGE)) {
-			addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
-		}
-		else {
-			req->vars_[key.toString()] = value.toString();
-		}
+		addVariable(req, key, value);
+	}
+}
+
+void
+Parser::parse(RequestImpl *req, const std::vector<std::pair<Range, Range> > &env, Logger* logger) {
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < env.size(); ++i) {
+		// the cookie header is stored as a header and as cookies
+		size += env[i].first.size() + (COOKIE_RANGE == env[i].first ? 2 : 1) * env[i].second.size();
+	}
+	req->env_buffer_.reserve(size);
+	req->vars_.reserve(env.size());
+	req->headers_.reserve(env.size());
+
+	for (std::size_t i = 0; i < env.size(); ++i) {
+		const Range &key = env[i].first, &value = env[i].second;
+		logger->debug("env[%d] = %.*s=%.*s", static_cast<int>(i), static_cast<int>(key.size()), key.begin(),
+			static_cast<int>(value.size()), value.begin());
+		addVariable(req, key, value);
 	}
 }
 
@@ -134,123 +159,63 @@ Parser::parseCookies(RequestImpl *req, const Range &range) {
 	}
 }
 
-static const std::string EMPTY_LINE_RNRN_STRING = "\r\n\r\n";
-static const std::string EMPTY_LINE_NN_STRING = "\n\n";
-static const std::string RETURN_RN_STRING = "\r\n";
-static const std::string RETURN_N_STRING = "\n";
-static const std::string ONE_SPACE_STRING = " ";
-static const std::string ONE_TAB_STRING = "\t";
-static const std::string MINUS_PREFIX_STRING = "--";
-static const std::string NAME_STRING = "name";
-static const std::string FILENAME_STRING = "filename";
 //static const std::string CONTENT_TYPE_STRING = "CONTENT_TYPE";
 static const std::string CONTENT_TYPE_STRING = "Content-Type";
 static const std::string CONTENT_ENCODING_STRING = "Content-Transfer-Encoding";
 
 void
-Parser::parseLine(DataBuffer line, DataBuffer &name, DataBuffer &filename, DataBuffer &type) {
+Parser::parseLine(Range line, Range &name, Range &filename, Range &type) {
 	while (!line.empty()) {
-		DataBuffer head, tail, key, value;
+		Range head, tail, key, value;
 		line.split(';', head, tail);
-		if(head.split('=', key, value)) {
-			if (NAME_STRING.size() == key.size() && key.startsWith(NAME_STRING)) {
+		if (head.split('=', key, value)) {
+			if (NAME_RANGE == key) {
 				name = value.trimn(1, 1);
 			}
-			else if (FILENAME_STRING.size() == key.size() && key.startsWith(FILENAME_STRING)) {
+			else if (FILENAME_RANGE == key) {
 				filename = value.trimn(1, 1);
 			}
-		} else if(head.split(':', key, value)){
-			if (CONTENT_TYPE_STRING.size() == key.size() && key.startsWithCI(CONTENT_TYPE_STRING)) {
+		}
+		else if (head.split(':', key, value)) {
+			if (CONTENT_TYPE_STRING.size() == key.size() &&
+				ByteSearch::equalsCI(key.begin(), CONTENT_TYPE_STRING.c_str(), key.size())) {
 				type = value.trim();
 			}
-			// if (CONTENT_ENCODING_STRING.size() == key.size() && key.startsWithCI(CONTENT_ENCODING_STRING)) {
-			// 	encoding = value.trim();
-			// }
 		}
 		line = tail.trim();
 	}
 }
 
 void
-Parser::parsePart(RequestImpl *req, DataBuffer part) {
-	DataBuffer headers, content;
-	DataBuffer name, filename, type;
-	if (!part.split(EMPTY_LINE_RNRN_STRING, headers, content)) {
-		part.split(EMPTY_LINE_NN_STRING, headers, content);
-	}
-	while (!headers.empty()) {
-		DataBuffer line;
-		DataBuffer tail = headers;
-		bool lineFound = false;
-		while (!tail.empty()) {
-			DataBuffer subline, subtail;
-			if (!tail.split(RETURN_RN_STRING, subline, subtail)) {
-				tail.split('\n', subline, subtail);
-			}
-			if (subline.startsWith(ONE_SPACE_STRING) || subline.startsWith(ONE_TAB_STRING)) {
-				line = DataBuffer(part, line.beginIndex(), subline.endIndex());
-			}
-			else {
-				if (lineFound) {
-					break;
-				}
-				line = subline;
-			}
-			tail = subtail;
-			lineFound = true;
+Parser::parsePart(RequestImpl *req, DataBuffer body, const Range &headers,
+	boost::uint64_t begin, boost::uint64_t end) {
+
+	Range name, filename, type;
+	Range tail = headers;
+	while (!tail.empty()) {
+		// a line that starts with a space or a tab continues the previous one
+		const char *line_begin = tail.begin();
+		Range line, rest;
+		while (tail.split('\n', line, rest) && !rest.empty() && (' ' == rest[0] || '\t' == rest[0])) {
+			tail = rest;
 		}
-		parseLine(line, name, filename, type);
-		headers = tail;
+		parseLine(Range(line_begin, line.end()).trim(), name, filename, type);
+		tail = rest;
 	}
 
 	if (name.empty()) {
 		return;
-	} 
-
-	std::string name_str;
-	name.toString(name_str);
+	}
 
+	std::string name_str = name.toString();
+	DataBuffer content(body, body.beginIndex() + begin, body.beginIndex() + end);
 	if (!filename.empty()) {
-		req->files_.insert(std::make_pair(name_str, File(filename, type, content)));
+		req->files_.insert(std::make_pair(name_str, File(filename.toString(), type.toString(), content)));
 	}
 	else {
 		std::string arg;
 		content.toString(arg);
-		req->args_.push_back(std::make_pair(name_str, arg));
-	}
-}
-
-void
-Parser::parseMultipart(RequestImpl *req, DataBuffer data, const std::string &boundary) {
-	DataBuffer head, tail;
-	while (!data.empty()) {
-		if (data.split(boundary, head, tail) && !head.empty()) {
-			if (head.endsWith(RETURN_RN_STRING)) {
-				head = head.trimn(0, 2);
-			}
-			else if (head.endsWith(RETURN_N_STRING)) {
-				head = head.trimn(0, 1);
-			}
-			else {
-				throw std::runtime_error("malformed multipart message");
-			}
-			if (head.startsWith(RETURN_RN_STRING)) {
-				head = head.trimn(2, 0);
-			}
-			else if (head.startsWith(RETURN_N_STRING)) {
-				head = head.trimn(1, 0);
-			}
-			else {
-				throw std::runtime_error("malformed multipart message");
-			}
-		}
-		if (!head.empty()) {
-			parsePart(req, head);
-		}
-		if (tail.startsWith(MINUS_PREFIX_STRING)) {
-			break;
-		}
-		data = tail;
+		req->addArg(name_str, arg);
 	}
 }
 
@@ -13,13 +13,27 @@ namespace fastcgi
 {
 
 Request::Request(Logger *logger, RequestCache *cache) :
-    impl_(new RequestImpl(logger, cache))
+    impl_(new RequestImpl(logger, cache, Arena::DEFAULT_BLOCK_SIZE))
+{}
+
+Request::Request(Logger *logger, RequestCache *cache, std::size_t arenaSize) :
+    impl_(new RequestImpl(logger, cache, arenaSize))
 {}
 
 Request::~Request() {
     impl_->saveToCache(this);
 }
 
+Arena*
+Request::arena() {
+    return impl_->arena();
+}
+
+void
+Request::setBodyFileThreshold(boost::uint64_t size, const std::string &dir) {
+    impl_->setBodyFileThreshold(size, dir);
+}
+
 unsigned short
 Request::getServerPort() const {
     return impl_->getServerPort();
@@ -213,6 +227,16 @@ Request::requestBody() const {
     return impl_->requestBody();
 }
 
+std::streamsize
+Request::readBody(char *buf, std::streamsize size) {
+    return impl_->readBody(buf, size);
+}
+
+bool
+Request::isBodyStreamed() const {
+    return impl_->isBodyStreamed();
+}
+
 void
 Request::setCookie(const Cookie &cookie) {
     impl_->setCookie(cookie);
@@ -253,6 +277,12 @@ Request::reset() {
     impl_->reset();
 }
 
+void
+Request::recycle() {
+    impl_->saveToCache(this);
+    impl_->reset();
+}
+
 void
 Request::sendHeaders() {
     impl_->sendHeaders();
@@ -263,6 +293,16 @@ Request::attach(RequestIOStream *stream, char *env[]) {
     impl_->attach(stream, env);
 }
 
+void
+Request::attach(RequestIOStream *stream, const std::vector<std::pair<Range, Range> > &env, bool streamBody) {
+    impl_->attach(stream, env, streamBody);
+}
+
+void
+Request::attachBody() {
+    impl_->attachBody();
+}
+
 bool
 Request::isProcessed() const {
     return impl_->isProcessed();
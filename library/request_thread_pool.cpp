@@ -4,6 +4,8 @@
 
 #include <sys/time.h>
 
+#include <boost/lexical_cast.hpp>
+
 #include <fastcgi2/except.h>
 #include <fastcgi2/handler.h>
 #include <fastcgi2/logger.h>
@@ -29,6 +31,11 @@ RequestsThreadPool::RequestsThreadPool(
         ThreadPool<RequestTask>(threadsNumber, queueLength), logger_(logger), delay_(delay)
 {}
 
+RequestsThreadPool::RequestsThreadPool(const ThreadPoolSettings &settings, boost::uint64_t delay,
+    const std::string &priorityHeader, fastcgi::Logger *logger) :
+        ThreadPool<RequestTask>(settings), logger_(logger), delay_(delay), priorityHeader_(priorityHeader)
+{}
+
 RequestsThreadPool::~RequestsThreadPool()
 {}
 
@@ -37,6 +44,24 @@ RequestsThreadPool::delay() const {
 	return delay_;
 }
 
+unsigned
+RequestsThreadPool::priority(const Request *request, unsigned handlerPriority) const {
+	if (priorityHeader_.empty() || !request->hasHeader(priorityHeader_)) {
+		return handlerPriority;
+	}
+	try {
+		return boost::lexical_cast<unsigned>(request->getHeader(priorityHeader_));
+	}
+	catch (const boost::bad_lexical_cast&) {
+		return handlerPriority;
+	}
+}
+
+void
+RequestsThreadPool::handleBindError(const std::exception &e) {
+	logger_->error("%s", e.what());
+}
+
 void
 RequestsThreadPool::handleTask(RequestTask task) {
     try {
@@ -56,14 +81,28 @@ RequestsThreadPool::handleTask(RequestTask task) {
                 logger_req_id->setRequestId(task.request->getRequestId());
             }
 
-            std::auto_ptr<HandlerContext> context(new HandlerContextImpl);
-            for (std::vector<Handler*>::iterator i = task.handlers.begin();
-                 i != task.handlers.end();
+            if (task.request->isBodyStreamed() && !task.streamBody) {
+                try {
+                    task.request->attachBody();
+                }
+                catch (const std::exception &e) {
+                    logger_->error("caught exception while attach request body: %s", e.what());
+                    task.request->sendError(400);
+                    return;
+                }
+                if (task.rematch && task.rematch(task)) {
+                    return;
+                }
+            }
+
+            HandlerContextImpl context(task.request->arena());
+            for (std::vector<Handler*>::const_iterator i = task.handlers->begin();
+                 i != task.handlers->end();
                  ++i) {
                 if (task.request->isProcessed()) {
                     break;
                 }
-                (*i)->handleRequest(task.request.get(), context.get());
+                (*i)->handleRequest(task.request.get(), &context);
             }
 
             task.request->sendHeaders();
@@ -2,16 +2,21 @@
 
 #include <pthread.h>
 
+#include <climits>
 #include <cctype>
 #include <iterator>
 #include <algorithm>
 #include <stdexcept>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/current_function.hpp>
 
 #include "fastcgi2/logger.h"
 #include "fastcgi2/request_io_stream.h"
 
+#include "details/chunked_buffer.h"
+#include "details/mapped_file_buffer.h"
+#include "details/multipart_parser.h"
 #include "details/parser.h"
 #include "details/request_cache.h"
 #include "details/range.h"
@@ -25,27 +30,6 @@ namespace fastcgi
 {
 
 static const std::string HEAD("HEAD");
-static const std::string HOST_KEY("host");
-static const std::string CONTENT_TYPE_KEY("content-type");
-static const std::string CONTENT_LENGTH_KEY("content-length");
-
-static const std::string HTTPS_KEY("HTTPS");
-static const std::string SERVER_ADDR_KEY("SERVER_ADDR");
-static const std::string SERVER_PORT_KEY("SERVER_PORT");
-
-static const std::string PATH_INFO_KEY("PATH_INFO");
-static const std::string PATH_TRANSLATED_KEY("PATH_TRANSLATED");
-
-static const std::string SCRIPT_NAME_KEY("SCRIPT_NAME");
-static const std::string SCRIPT_FILENAME_KEY("SCRIPT_FILENAME");
-static const std::string DOCUMENT_ROOT_KEY("DOCUMENT_ROOT");
-
-static const std::string REMOTE_USER_KEY("REMOTE_USER");
-static const std::string REMOTE_ADDR_KEY("REMOTE_ADDR");
-
-static const std::string QUERY_STRING_KEY("QUERY_STRING");
-static const std::string REQUEST_METHOD_KEY("REQUEST_METHOD");
-static const std::string REQUEST_ID_KEY("REQUEST_ID");
 
 File::File(DataBuffer filename, DataBuffer type, DataBuffer content) :
 	data_(content)
@@ -85,8 +69,84 @@ File::data() const {
 	return data_;
 }
 
-RequestImpl::RequestImpl(Logger *logger, RequestCache *cache) :
-	processed_(false), delay_(0), logger_(logger), cache_(cache)
+const std::size_t ArgIndex::NPOS;
+
+ArgIndex::ArgIndex(Arena *arena) :
+	slots_(IndexVector::allocator_type(arena)), next_(IndexVector::allocator_type(arena)),
+	last_(IndexVector::allocator_type(arena)), names_(0)
+{}
+
+void
+ArgIndex::update(const ArgVector &args) {
+	for (std::size_t i = next_.size(), size = args.size(); i < size; ++i) {
+		next_.push_back(NPOS);
+		last_.push_back(i);
+		if (2 * (names_ + 1) > slots_.size()) {
+			rehash(args, std::max(static_cast<std::size_t>(16), 2 * slots_.size()));
+		}
+		std::size_t pos = slot(args, args[i].first);
+		if (0 == slots_[pos]) {
+			slots_[pos] = i + 1;
+			++names_;
+		}
+		else {
+			std::size_t first = slots_[pos] - 1;
+			next_[last_[first]] = i;
+			last_[first] = i;
+		}
+	}
+}
+
+std::size_t
+ArgIndex::first(const ArgVector &args, const std::string &name) const {
+	if (slots_.empty()) {
+		return NPOS;
+	}
+	return slots_[slot(args, name)] - 1;
+}
+
+std::size_t
+ArgIndex::next(std::size_t index) const {
+	return next_[index];
+}
+
+void
+ArgIndex::clear() {
+	IndexVector(slots_.get_allocator()).swap(slots_);
+	IndexVector(next_.get_allocator()).swap(next_);
+	IndexVector(last_.get_allocator()).swap(last_);
+	names_ = 0;
+}
+
+// the slot of the name or the empty slot it would take
+std::size_t
+ArgIndex::slot(const ArgVector &args, const std::string &name) const {
+	std::size_t mask = slots_.size() - 1;
+	for (std::size_t pos = ciHash(name.data(), name.size()) & mask; ; pos = (pos + 1) & mask) {
+		if (0 == slots_[pos] || args[slots_[pos] - 1].first == name) {
+			return pos;
+		}
+	}
+}
+
+void
+ArgIndex::rehash(const ArgVector &args, std::size_t capacity) {
+	IndexVector slots(capacity, 0, slots_.get_allocator());
+	slots_.swap(slots);
+	for (IndexVector::const_iterator i = slots.begin(), end = slots.end(); i != end; ++i) {
+		if (*i) {
+			slots_[slot(args, args[*i - 1].first)] = *i;
+		}
+	}
+}
+
+RequestImpl::RequestImpl(Logger *logger, RequestCache *cache, std::size_t arenaSize) :
+	processed_(false), delay_(0), arena_(arenaSize), env_buffer_(EnvMap::Buffer::allocator_type(&arena_)),
+	vars_(env_buffer_, false), cookies_(env_buffer_, false), headers_(env_buffer_, true),
+	out_cookies_(std::less<Cookie>(), CookieSet::allocator_type(&arena_)),
+	files_(std::less<std::string>(), FileMap::allocator_type(&arena_)), args_indexed_(true),
+	args_(ArgVector::allocator_type(&arena_)), raw_args_(RangeVector::allocator_type(&arena_)),
+	arg_index_(&arena_), logger_(logger), cache_(cache), body_file_threshold_(0)
 {
 	reset();
 }
@@ -94,75 +154,86 @@ RequestImpl::RequestImpl(Logger *logger, RequestCache *cache) :
 RequestImpl::~RequestImpl() {
 }
 
+Arena*
+RequestImpl::arena() {
+	return &arena_;
+}
+
+void
+RequestImpl::setBodyFileThreshold(boost::uint64_t size, const std::string &dir) {
+	body_file_threshold_ = size;
+	body_file_dir_ = dir;
+}
+
 unsigned short
 RequestImpl::getServerPort() const {
-	const std::string &res = Parser::get(vars_, SERVER_PORT_KEY);
+	const std::string &res = vars_.get(EnvMap::SERVER_PORT);
 	return (!res.empty()) ? boost::lexical_cast<unsigned short>(res) : 80;
 }
 
 const std::string&
 RequestImpl::getHost() const {
-	return Parser::get(headers_, HOST_KEY);
+	return headers_.get(EnvMap::HOST);
 }
 
 const std::string&
 RequestImpl::getServerAddr() const {
-	return Parser::get(vars_, SERVER_ADDR_KEY);
+	return vars_.get(EnvMap::SERVER_ADDR);
 }
 
 const std::string&
 RequestImpl::getPathInfo() const {
-	return Parser::get(vars_, PATH_INFO_KEY);
+	return vars_.get(EnvMap::PATH_INFO);
 }
 
 const std::string&
 RequestImpl::getPathTranslated() const {
-		return Parser::get(vars_, PATH_TRANSLATED_KEY);
+		return vars_.get(EnvMap::PATH_TRANSLATED);
 }
 
 const std::string&
 RequestImpl::getScriptName() const {
-	return Parser::get(vars_, SCRIPT_NAME_KEY);
+	return vars_.get(EnvMap::SCRIPT_NAME);
 }
 
 const std::string&
 RequestImpl::getScriptFilename() const {
-	return Parser::get(vars_, SCRIPT_FILENAME_KEY);
+	return vars_.get(EnvMap::SCRIPT_FILENAME);
 }
 
 const std::string&
 RequestImpl::getDocumentRoot() const {
-	return Parser::get(vars_, DOCUMENT_ROOT_KEY);
+	return vars_.get(EnvMap::DOCUMENT_ROOT);
 }
 
 const std::string&
 RequestImpl::getRemoteUser() const {
-	return Parser::get(vars_, REMOTE_USER_KEY);
+	return vars_.get(EnvMap::REMOTE_USER);
 }
 
 const std::string&
 RequestImpl::getRemoteAddr() const {
-	return Parser::get(vars_, REMOTE_ADDR_KEY);
+	return vars_.get(EnvMap::REMOTE_ADDR);
 }
 
 const std::string&
 RequestImpl::getQueryString() const {
-	return Parser::get(vars_, QUERY_STRING_KEY);
+	return vars_.get(EnvMap::QUERY_STRING);
 }
 
 const std::string&
 RequestImpl::getRequestMethod() const {
-	return Parser::get(vars_, REQUEST_METHOD_KEY);
+	return vars_.get(EnvMap::REQUEST_METHOD);
 }
 
 const std::string&
 RequestImpl::getRequestId() const {
-	return Parser::get(vars_, REQUEST_ID_KEY);
+	return vars_.get(EnvMap::REQUEST_ID);
 }
 
 std::streamsize
 RequestImpl::getContentLength() const {
-	const std::string& header = Parser::get(headers_, CONTENT_LENGTH_KEY);
+	const std::string& header = headers_.get(EnvMap::CONTENT_LENGTH);
 	if (header.empty()) {
 		return 0;
 	}
@@ -176,59 +247,125 @@ RequestImpl::getContentLength() const {
 
 const std::string&
 RequestImpl::getContentType() const {
-	return Parser::get(headers_, CONTENT_TYPE_KEY);
+	return headers_.get(EnvMap::CONTENT_TYPE);
 }
 
 unsigned int
 RequestImpl::countArgs() const {
+	std::lock_guard<std::mutex> lock(args_mutex_);
+	indexArgs();
 	return args_.size();
 }
 
 bool
 RequestImpl::hasArg(const std::string &name) const {
-	for (std::vector<StringUtils::NamedValue>::const_iterator i = args_.begin(), end = args_.end(); i != end; ++i) {
-		if (i->first == name) {
-			return true;
-		}
-	}
-	return false;
+	std::lock_guard<std::mutex> lock(args_mutex_);
+	indexArgs();
+	return ArgIndex::NPOS != arg_index_.first(args_, name);
 }
 
 const std::string&
 RequestImpl::getArg(const std::string &name) const {
-	for (std::vector<StringUtils::NamedValue>::const_iterator i = args_.begin(), end = args_.end(); i != end; ++i) {
-		if (i->first == name) {
-			return i->second;
-		}
-	}
-	return StringUtils::EMPTY_STRING;
+	std::lock_guard<std::mutex> lock(args_mutex_);
+	indexArgs();
+	std::size_t index = arg_index_.first(args_, name);
+	return (ArgIndex::NPOS == index) ? StringUtils::EMPTY_STRING : argValue(index);
 }
 
 void
 RequestImpl::getArg(const std::string &name, std::vector<std::string> &v) const {
-	
+	std::lock_guard<std::mutex> lock(args_mutex_);
+	indexArgs();
 	std::vector<std::string> tmp;
-	tmp.reserve(args_.size());
-	for (std::vector<StringUtils::NamedValue>::const_iterator i = args_.begin(), end = args_.end(); i != end; ++i) {
-		if (i->first == name) {
-			tmp.push_back(i->second);
-		}
+	for (std::size_t i = arg_index_.first(args_, name); ArgIndex::NPOS != i; i = arg_index_.next(i)) {
+		tmp.push_back(argValue(i));
 	}
 	v.swap(tmp);
 }
 
 void
 RequestImpl::argNames(std::vector<std::string> &v) const {
-	std::set<std::string> names;
-	for (std::vector<StringUtils::NamedValue>::const_iterator i = args_.begin(), end = args_.end(); i != end; ++i) {
-		names.insert(i->first);
-	}
+	std::lock_guard<std::mutex> lock(args_mutex_);
+	indexArgs();
 	std::vector<std::string> tmp;
-	tmp.reserve(names.size());
-	std::copy(names.begin(), names.end(), std::back_inserter(tmp));
+	for (std::size_t i = 0, size = args_.size(); i < size; ++i) {
+		if (arg_index_.first(args_, args_[i].first) == i) {
+			tmp.push_back(args_[i].first);
+		}
+	}
+	std::sort(tmp.begin(), tmp.end());
 	v.swap(tmp);
 }
 
+void
+RequestImpl::addArg(const std::string &name, const std::string &value) {
+	indexArgs();
+	args_.push_back(std::make_pair(name, value));
+	raw_args_.push_back(Range());
+	arg_index_.update(args_);
+}
+
+static void
+splitArgs(const Range &range, ArgVector &args, RangeVector &raw) {
+	Range tmp = range;
+	while (!tmp.empty()) {
+		Range key, value, head, tail;
+		tmp.split('&', head, tail);
+		head.split('=', key, value);
+		if (!key.empty()) {
+			args.push_back(StringUtils::NamedValue(StringUtils::urldecode(key), std::string()));
+			raw.push_back(value);
+		}
+		tmp = tail;
+	}
+}
+
+// the caller holds args_mutex_ unless the request is not shared yet
+void
+RequestImpl::indexArgs() const {
+	if (args_indexed_) {
+		return;
+	}
+	args_indexed_ = true;
+	splitArgs(query_args_, args_, raw_args_);
+	if (!form_args_.isNil()) {
+		DataBuffer::SegmentIterator first = form_args_.begin(), end = form_args_.end();
+		DataBuffer::SegmentIterator next = first;
+		if (first == end || ++next == end) {
+			if (first != end) {
+				splitArgs(Range(first->first, first->first + first->second), args_, raw_args_);
+			}
+		}
+		else {
+			// ranges can not span segments, such a body is decoded at once
+			Parser::parseArgs(form_args_, args_);
+			raw_args_.resize(args_.size());
+		}
+	}
+	arg_index_.update(args_);
+}
+
+void
+RequestImpl::decodeArgs() const {
+	std::lock_guard<std::mutex> lock(args_mutex_);
+	indexArgs();
+	for (std::size_t i = 0, size = args_.size(); i < size; ++i) {
+		argValue(i);
+	}
+}
+
+const std::string&
+RequestImpl::argValue(std::size_t index) const {
+	Range &raw = raw_args_[index];
+	std::string &value = args_[index].second;
+	if (!raw.empty()) {
+		value.resize(raw.size());
+		value.resize(StringUtils::urldecode(raw, &value[0]) - value.data());
+		raw = Range();
+	}
+	return value;
+}
+
 unsigned int
 RequestImpl::countHeaders() const {
 	return headers_.size();
@@ -236,17 +373,17 @@ RequestImpl::countHeaders() const {
 
 bool
 RequestImpl::hasHeader(const std::string &name) const {
-	return Parser::has(headers_, name);
+	return headers_.has(name);
 }
 
 const std::string&
 RequestImpl::getHeader(const std::string &name) const {
-	return Parser::get(headers_, name);
+	return headers_.get(name);
 }
 
 void
 RequestImpl::headerNames(std::vector<std::string> &v) const {
-	Parser::keys(headers_, v);
+	headers_.keys(v);
 }
 
 unsigned int
@@ -256,17 +393,17 @@ RequestImpl::countCookie() const {
 
 bool
 RequestImpl::hasCookie(const std::string &name) const {
-	return Parser::has(cookies_, name);
+	return cookies_.has(name);
 }
 
 const std::string&
 RequestImpl::getCookie(const std::string &name) const {
-	return Parser::get(cookies_, name);
+	return cookies_.get(name);
 }
 
 void
 RequestImpl::cookieNames(std::vector<std::string> &v) const {
-	Parser::keys(cookies_, v);
+	cookies_.keys(v);
 }
 
 bool
@@ -278,7 +415,7 @@ void
 RequestImpl::remoteFiles(std::vector<std::string> &v) const {
 	std::vector<std::string> tmp;
 	tmp.reserve(files_.size());
-	for (std::map<std::string, File>::const_iterator i = files_.begin(), end = files_.end(); i != end; ++i) {
+	for (FileMap::const_iterator i = files_.begin(), end = files_.end(); i != end; ++i) {
 		tmp.push_back(i->first);
 	}
 	v.swap(tmp);
@@ -286,7 +423,7 @@ RequestImpl::remoteFiles(std::vector<std::string> &v) const {
 
 const std::string&
 RequestImpl::remoteFileName(const std::string &name) const {
-	std::map<std::string, File>::const_iterator i = files_.find(name);
+	FileMap::const_iterator i = files_.find(name);
 	if (files_.end() != i) {
 		return i->second.remoteName();
 	}
@@ -295,7 +432,7 @@ RequestImpl::remoteFileName(const std::string &name) const {
 
 const std::string&
 RequestImpl::remoteFileType(const std::string &name) const {
-	std::map<std::string, File>::const_iterator i = files_.find(name);
+	FileMap::const_iterator i = files_.find(name);
 	if (files_.end() != i) {
 		return i->second.type();
 	}
@@ -304,7 +441,7 @@ RequestImpl::remoteFileType(const std::string &name) const {
 
 DataBuffer
 RequestImpl::remoteFile(const std::string &name) const {
-	std::map<std::string, File>::const_iterator i = files_.find(name);
+	FileMap::const_iterator i = files_.find(name);
 	if (files_.end() != i) {
 		return i->second.data();
 	}
@@ -313,7 +450,7 @@ RequestImpl::remoteFile(const std::string &name) const {
 
 bool
 RequestImpl::isSecure() const {
-	const std::string &val = Parser::get(vars_, HTTPS_KEY);
+	const std::string &val = vars_.get(EnvMap::HTTPS);
 	return !val.empty() && ("on" == val);
 }
 
@@ -322,10 +459,31 @@ RequestImpl::requestBody() const {
 	return body_;
 }
 
+std::streamsize
+RequestImpl::readBody(char *buf, std::streamsize size) {
+	std::streamsize len = 0;
+	if (stream_body_) {
+		if (NULL == stream_) {
+			throw std::runtime_error("Error in RequestImpl::readBody: request is not attached");
+		}
+		len = stream_->read(buf, size);
+	}
+	else {
+		len = body_.isNil() ? 0 : body_.read(body_read_, buf, size);
+	}
+	body_read_ += len;
+	return len;
+}
+
+bool
+RequestImpl::isBodyStreamed() const {
+	return stream_body_;
+}
+
 void
 RequestImpl::setCookie(const Cookie &cookie) {
 	if (!headers_sent_) {
-		std::pair<std::set<Cookie>::iterator, bool> p = out_cookies_.insert(cookie);
+		std::pair<CookieSet::iterator, bool> p = out_cookies_.insert(cookie);
 		if (!p.second) {
 			Cookie& target = const_cast<Cookie&>(*p.first);
 			target = cookie;
@@ -359,13 +517,10 @@ RequestImpl::sendError(unsigned short status) {
 	out_headers_.insert(std::pair<std::string, std::string>("Content-type", "text/html"));
 	sendHeadersInternal();
 	if (stream_) {
-		stream_->write("<html><body><h1>", sizeof("<html><body><h1>") - 1);
-		std::string status_str = boost::lexical_cast<std::string>(status);
-		stream_->write(status_str.c_str(), status_str.size());
-		stream_->write(" ", 1);
-		const char* stat = Parser::statusToString(status);
-		stream_->write(stat, strlen(stat));
-		stream_->write("</h1></body></html>", sizeof("</h1></body></html>") - 1);
+		std::string body("<html><body><h1>");
+		body.append(boost::lexical_cast<std::string>(status)).append(" ");
+		body.append(Parser::statusToString(status)).append("</h1></body></html>");
+		stream_->write(body.c_str(), body.size());
 	}
 }
 
@@ -406,16 +561,30 @@ RequestImpl::reset() {
 	
 	status_ = 200;
 	stream_ = NULL;
+	stream_body_ = false;
+	body_read_ = 0;
 	headers_sent_ = false;
+	processed_ = false;
+	delay_ = 0;
+	body_ = DataBuffer();
 
-	args_.clear();
 	vars_.clear();
-	
-	files_.clear();
 	cookies_.clear();
 	headers_.clear();
+	files_.clear();
 	out_cookies_.clear();
 	out_headers_.clear();
+
+	args_indexed_ = true;
+	query_args_ = Range();
+	form_args_ = DataBuffer();
+
+	// nothing may keep arena memory when the arena is rewound
+	ArgVector(args_.get_allocator()).swap(args_);
+	RangeVector(raw_args_.get_allocator()).swap(raw_args_);
+	arg_index_.clear();
+	EnvMap::Buffer(env_buffer_.get_allocator()).swap(env_buffer_);
+	arena_.reset();
 }
 
 void
@@ -432,10 +601,50 @@ RequestImpl::attach(RequestIOStream *stream, char *env[]) {
 		throw std::runtime_error("ENV is NULL");
 	}
 	stream_ = stream;
+	stream_body_ = false;
+	Parser::parse(this, env, logger_);
+	parseRequest();
+}
+
+void
+RequestImpl::attach(RequestIOStream *stream, const std::vector<std::pair<Range, Range> > &env, bool streamBody) {
+	if (NULL == stream) {
+		throw std::runtime_error("Stream is NULL");
+	}
+	stream_ = stream;
+	stream_body_ = streamBody;
 	Parser::parse(this, env, logger_);
+	parseRequest();
+}
+
+void
+RequestImpl::attachBody() {
+	if (!stream_body_) {
+		return;
+	}
+	stream_body_ = false;
+	parseEntity();
+	if (!args_indexed_) {
+		// arguments looked up before the body was read are indexed again with the form
+		args_.clear();
+		raw_args_.clear();
+		arg_index_.clear();
+	}
+}
+
+void
+RequestImpl::parseRequest() {
 	const std::string& query = getQueryString();
+	query_args_ = Range::fromString(query);
+	args_indexed_ = query_args_.empty();
+	if (!stream_body_) {
+		parseEntity();
+	}
+}
+
+void
+RequestImpl::parseEntity() {
 	if ("POST" != getRequestMethod() && "PUT" != getRequestMethod()) {
-		StringUtils::parse(query, args_);
 		return;
 	}
 
@@ -447,37 +656,38 @@ RequestImpl::attach(RequestIOStream *stream, char *env[]) {
 		shift = serializeInt(post_buffer, shift, size);
 		body_ = DataBuffer(post_buffer, post_buffer.beginIndex() + shift, post_buffer.endIndex());
 	}
+	else if (body_file_threshold_ && size > body_file_threshold_) {
+		body_ = DataBuffer::create(new MappedFileBuffer(body_file_dir_, size));
+	}
+	else if (size > ChunkedBuffer::BLOCK_SIZE) {
+		// a large body is read into pooled blocks, a small one into one allocation
+		body_ = DataBuffer::create(new ChunkedBuffer(size));
+	}
 	else {
 		body_ = DataBuffer::create(StringUtils::EMPTY_STRING.c_str(), 0);
 		body_.resize(size);
 	}
-	boost::uint64_t rsz = 0;
-	for (DataBuffer::SegmentIterator it = body_.begin(), end;
-		 it != end;
-		 ++it) {
-		rsz += stream_->read(it->first, it->second);
-	}
-	if (rsz != size) {
-		throw std::runtime_error("failed to read request entity");
-	}
-
-	if (!query.empty()) {
-		StringUtils::parse(query, args_);
-	}
 
 	const std::string &type = getContentType();
 	if (0 == strncasecmp("multipart/form-data", type.c_str(), sizeof("multipart/form-data") - 1)) {
 		std::string boundary = Parser::getBoundary(Range::fromString(type));
 		if (!boundary.empty()) {
-		    Parser::parseMultipart(this, body_, boundary);
+			// parts are parsed while the body is read
+			MultipartParser parser(boundary, boost::bind(&Parser::parsePart, this, body_, _1, _2, _3));
+			readEntity(size, &parser);
+		}
+		else {
+			readEntity(size, NULL);
 		}
 	}
 	else {
+		readEntity(size, NULL);
 		if (0 != strncasecmp("text/plain", type.c_str(), sizeof("text/plain") - 1) &&
 			0 != strncasecmp("application/octet-stream", type.c_str(), sizeof("application/octet-stream") - 1) &&
 			!disablePostParams())
 		{
-			StringUtils::parse(body_, args_);
+			form_args_ = body_;
+			args_indexed_ = false;
 		}
 	}
 
@@ -490,9 +700,35 @@ RequestImpl::attach(RequestIOStream *stream, char *env[]) {
 	}
 }
 
+void
+RequestImpl::readEntity(boost::uint64_t size, MultipartParser *parser) {
+	boost::uint64_t rsz = 0;
+	for (DataBuffer::SegmentIterator it = body_.begin(), end;
+		 it != end;
+		 ++it) {
+		char *data = it->first;
+		boost::uint64_t left = it->second;
+		while (left) {
+			int len = stream_->read(data, std::min(left, static_cast<boost::uint64_t>(INT_MAX)));
+			if (len <= 0) {
+				break;
+			}
+			if (parser) {
+				parser->feed(data, len);
+			}
+			rsz += len;
+			data += len;
+			left -= len;
+		}
+	}
+	if (rsz != size) {
+		throw std::runtime_error("failed to read request entity");
+	}
+}
+
 bool
 RequestImpl::disablePostParams() const {
-	const std::string& disable_params = Parser::get(vars_, "DISABLE_POST_PARAMS");
+	const std::string& disable_params = vars_.get("DISABLE_POST_PARAMS");
 	if (disable_params.empty()) {
 		return false;
 	}
@@ -501,6 +737,17 @@ RequestImpl::disablePostParams() const {
 		   0 == strcasecmp("1", disable_params.c_str());
 }
 
+static const char HEADER_SEPARATOR[] = ": ";
+static const char SET_COOKIE_PREFIX[] = "Set-Cookie: ";
+static const char LINE_END[] = "\r\n";
+
+static inline void
+addPiece(struct iovec *&iov, const char *data, std::size_t size) {
+	iov->iov_base = const_cast<char*>(data);
+	iov->iov_len = size;
+	++iov;
+}
+
 void
 RequestImpl::sendHeadersInternal() {
 	if (!headers_sent_) {
@@ -508,19 +755,32 @@ RequestImpl::sendHeadersInternal() {
 		stream << status_ << " " << Parser::statusToString(status_);
 		out_headers_["Status"] = stream.str();
 		if (stream_) {
+			// the header block refers to the header and cookie strings and
+			// goes to the stream in one write, the lists live in the arena
+			typedef std::vector<std::string, ArenaAllocator<std::string> > StringVector;
+			StringVector cookies = StringVector(StringVector::allocator_type(&arena_));
+			cookies.reserve(out_cookies_.size());
+			for (CookieSet::const_iterator i = out_cookies_.begin(), end = out_cookies_.end(); i != end; ++i) {
+				cookies.push_back(i->toString());
+			}
+
+			const std::size_t count = 4 * out_headers_.size() + 3 * cookies.size() + 1;
+			struct iovec *begin = static_cast<struct iovec*>(
+				arena_.allocate(count * sizeof(struct iovec), alignof(struct iovec)));
+			struct iovec *iov = begin;
 			for (HeaderMap::iterator i = out_headers_.begin(), end = out_headers_.end(); i != end; ++i) {
-				stream_->write(i->first.c_str(), i->first.size());
-				stream_->write(": ", 2);
-				stream_->write(i->second.c_str(), i->second.size());
-				stream_->write("\r\n", 2);
+				addPiece(iov, i->first.c_str(), i->first.size());
+				addPiece(iov, HEADER_SEPARATOR, sizeof(HEADER_SEPARATOR) - 1);
+				addPiece(iov, i->second.c_str(), i->second.size());
+				addPiece(iov, LINE_END, sizeof(LINE_END) - 1);
 			}
-			for (std::set<Cookie>::const_iterator i = out_cookies_.begin(), end = out_cookies_.end(); i != end; ++i) {
-				stream_->write("Set-Cookie: ", sizeof("Set-Cookie: ") - 1);
-				std::string cookie = i->toString();
-				stream_->write(cookie.c_str(), cookie.size());
-				stream_->write("\r\n", 2);
+			for (std::size_t i = 0; i < cookies.size(); ++i) {
+				addPiece(iov, SET_COOKIE_PREFIX, sizeof(SET_COOKIE_PREFIX) - 1);
+				addPiece(iov, cookies[i].c_str(), cookies[i].size());
+				addPiece(iov, LINE_END, sizeof(LINE_END) - 1);
 			}
-			stream_->write("\r\n", 2);
+			addPiece(iov, LINE_END, sizeof(LINE_END) - 1);
+			stream_->write(begin, iov - begin);
 		}
 		headers_sent_ = true;
 	}
@@ -541,57 +801,35 @@ RequestImpl::tryAgain(time_t delay) {
 }
 
 boost::uint64_t
-RequestImpl::serializeEnv(DataBuffer &buffer, boost::uint64_t add_size) {
-	boost::uint64_t header_size = 0;
-	for (HeaderMap::iterator it = headers_.begin(), end = headers_.end();
-		 it != end;
-		 ++it) {
-		header_size += it->first.size();
-		header_size += it->second.size();
-		header_size += 2*sizeof(boost::uint64_t);
-	}
-	boost::uint64_t cookie_size = 0;
-	for (VarMap::iterator it = cookies_.begin(), end = cookies_.end();
-		 it != end;
-		 ++it) {
-		cookie_size += it->first.size();
-		cookie_size += it->second.size();
-		cookie_size += 2*sizeof(boost::uint64_t);
-	}
-	boost::uint64_t var_size = 0;
-	for (VarMap::iterator it = vars_.begin(), end = vars_.end();
-		 it != end;
-		 ++it) {
-		var_size += it->first.size();
-		var_size += it->second.size();
-		var_size += 2*sizeof(boost::uint64_t);
+RequestImpl::envMapSerializedSize(const EnvMap &map) {
+	boost::uint64_t size = 0;
+	for (std::size_t i = 0; i < map.size(); ++i) {
+		size += map.key(i).size();
+		size += map.value(i).size();
+		size += 2*sizeof(boost::uint64_t);
 	}
-	buffer.resize(add_size + header_size + cookie_size +
-		var_size + 3*sizeof(boost::uint64_t));
+	return size;
+}
 
-	boost::uint64_t pos = 0;
-	pos = serializeInt(buffer, pos, header_size);
-	for (HeaderMap::iterator it = headers_.begin(), end = headers_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second);
-	}
-	pos = serializeInt(buffer, pos, cookie_size);
-	for (VarMap::iterator it = cookies_.begin(), end = cookies_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second);
-	}
-	pos = serializeInt(buffer, pos, var_size);
-	for (VarMap::iterator it = vars_.begin(), end = vars_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second);
+boost::uint64_t
+RequestImpl::serializeEnvMap(DataBuffer &buffer, boost::uint64_t pos, const EnvMap &map) {
+	pos = serializeInt(buffer, pos, envMapSerializedSize(map));
+	for (std::size_t i = 0; i < map.size(); ++i) {
+		pos = serializeString(buffer, pos, map.key(i));
+		pos = serializeString(buffer, pos, map.value(i));
 	}
+	return pos;
+}
 
+boost::uint64_t
+RequestImpl::serializeEnv(DataBuffer &buffer, boost::uint64_t add_size) {
+	buffer.resize(add_size + envMapSerializedSize(headers_) + envMapSerializedSize(cookies_) +
+		envMapSerializedSize(vars_) + 3*sizeof(boost::uint64_t));
+
+	boost::uint64_t pos = 0;
+	pos = serializeEnvMap(buffer, pos, headers_);
+	pos = serializeEnvMap(buffer, pos, cookies_);
+	pos = serializeEnvMap(buffer, pos, vars_);
 	return pos;
 }
 
@@ -611,6 +849,15 @@ RequestImpl::serializeString(DataBuffer &buffer, boost::uint64_t pos,
 	return pos;
 }
 
+boost::uint64_t
+RequestImpl::serializeString(DataBuffer &buffer, boost::uint64_t pos,
+	const Range &val) {
+	boost::uint64_t size = val.size();
+	pos = serializeInt(buffer, pos, size);
+	pos += buffer.write(pos, val.begin(), size);
+	return pos;
+}
+
 boost::uint64_t
 RequestImpl::serializeBuffer(DataBuffer &buffer, boost::uint64_t pos,
 	const DataBuffer &src) {
@@ -627,7 +874,7 @@ RequestImpl::serializeBuffer(DataBuffer &buffer, boost::uint64_t pos,
 boost::uint64_t
 RequestImpl::filesSerializedSize() {
 	boost::uint64_t file_size = 0;
-	for (std::map<std::string, File>::iterator it = files_.begin(), end = files_.end();
+	for (FileMap::iterator it = files_.begin(), end = files_.end();
 		 it != end;
 		 ++it) {
 		file_size += sizeof(boost::uint64_t);
@@ -643,8 +890,9 @@ RequestImpl::filesSerializedSize() {
 
 boost::uint64_t
 RequestImpl::argsSerializedSize() {
+	decodeArgs();
 	boost::uint64_t arg_size = 0;
-	for (std::vector<StringUtils::NamedValue>::iterator it = args_.begin(),
+	for (ArgVector::iterator it = args_.begin(),
 			end = args_.end();
 		 it != end;
 		 ++it) {
@@ -676,7 +924,7 @@ boost::uint64_t
 RequestImpl::serializeFiles(DataBuffer &buffer, boost::uint64_t pos) {
 	boost::uint64_t file_size = filesSerializedSize();
 	pos = serializeInt(buffer, pos, file_size);
-	for (std::map<std::string, File>::iterator it = files_.begin(), end = files_.end();
+	for (FileMap::iterator it = files_.begin(), end = files_.end();
 		 it != end;
 		 ++it) {
 		pos = serializeString(buffer, pos, it->first);
@@ -692,8 +940,9 @@ RequestImpl::serializeFiles(DataBuffer &buffer, boost::uint64_t pos) {
 boost::uint64_t
 RequestImpl::serializeArgs(DataBuffer &buffer, boost::uint64_t pos) {
 	boost::uint64_t arg_size = argsSerializedSize();
+	std::lock_guard<std::mutex> lock(args_mutex_);
 	pos = serializeInt(buffer, pos, arg_size);
-	for (std::vector<StringUtils::NamedValue>::iterator it = args_.begin(),
+	for (ArgVector::iterator it = args_.begin(),
 			end = args_.end();
 		 it != end;
 		 ++it) {
@@ -731,7 +980,7 @@ RequestImpl::parseHeaders(DataBuffer buffer, boost::uint64_t pos) {
 		std::string name, value;
 		pos = parseString(buffer, pos, name);
 		pos = parseString(buffer, pos, value);
-		headers_.insert(std::make_pair(name, value));
+		headers_.add(Range::fromString(name), Range::fromString(value));
     }
     return pos;
 }
@@ -748,7 +997,7 @@ RequestImpl::parseCookies(DataBuffer buffer, boost::uint64_t pos) {
 		std::string name, value;
 		pos = parseString(buffer, pos, name);
 		pos = parseString(buffer, pos, value);
-		cookies_.insert(std::make_pair(name, value));
+		cookies_.add(Range::fromString(name), Range::fromString(value));
     }
     return pos;
 }
@@ -765,7 +1014,7 @@ RequestImpl::parseVars(DataBuffer buffer, boost::uint64_t pos) {
 		std::string name, value;
 		pos = parseString(buffer, pos, name);
 		pos = parseString(buffer, pos, value);
-		vars_.insert(std::make_pair(name, value));
+		vars_.add(Range::fromString(name), Range::fromString(value));
 	}
 	return pos;
 }
@@ -824,7 +1073,7 @@ RequestImpl::parseArgs(DataBuffer buffer, boost::uint64_t pos) {
 			value = StringUtils::urlencode(Range::fromString(value));
 		}
 
-		args_.push_back(std::make_pair(name, value));
+		addArg(name, value);
 	}
 	return pos;
 }
@@ -841,7 +1090,9 @@ RequestImpl::parse(DataBuffer buffer) {
 
 void
 RequestImpl::saveToCache(Request *request) {
-	if (cache_) {
+	// a recycled request that waits for the next one has nothing to save,
+	// the body of a streamed one is gone with the stream
+	if (cache_ && vars_.size() && !stream_body_) {
 		cache_->save(request, delay_);
 	}
 }
@@ -35,7 +35,7 @@ Server::handleRequestInternal(const HandlerSet::HandlerDescription* handler, Req
 	}
 
 	try {
-		task.handlers = handler->handlers;
+		task.handlers = &handler->handlers;
 		RequestsThreadPool* pool = globals()->pools().find(handler->poolName)->second.get();
     	if (pool->delay()) {
     		struct timeval now;
@@ -45,7 +45,8 @@ Server::handleRequestInternal(const HandlerSet::HandlerDescription* handler, Req
     	else {
     		task.start = 0;
     	}
-		pool->addTask(task);
+		const unsigned priority = pool->priority(task.request.get(), handler->priority);
+		pool->addTask(std::move(task), priority);
 	}
 	catch (const std::exception &e) {
 		task.request->sendError(503);
@@ -54,7 +55,7 @@ Server::handleRequestInternal(const HandlerSet::HandlerDescription* handler, Req
 }
 
 const HandlerSet::HandlerDescription*
-Server::getHandler(RequestTask task) const {
+Server::getHandler(const RequestTask &task) const {
 	return globals()->handlers()->findURIHandler(task.request.get());
 }
 
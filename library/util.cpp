@@ -1,10 +1,13 @@
 #include "settings.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 
 #include "fastcgi2/util.h"
 #include "fastcgi2/logger.h"
+#include "details/byte_search.h"
+#include "details/parser.h"
 #include "details/range.h"
 
 #ifdef HAVE_DMALLOC_H
@@ -25,60 +28,85 @@ StringUtils::~StringUtils() {
 
 std::string
 StringUtils::urlencode(const Range &range) {
-	
 	std::string result;
-	result.reserve(3 * range.size());
-	
-	for (const char* i = range.begin(), *end = range.end(); i != end; ++i) {
-		char symbol = (*i);
-		if (isalnum(symbol)) {
-			result.append(1, symbol);
-			continue;
+	result.resize(urlencodedSize(range));
+	if (!result.empty()) {
+		urlencode(range, &result[0]);
+	}
+	return result;
+}
+
+std::size_t
+StringUtils::urlencodedSize(const Range &range) {
+	return range.size() + 2 * ByteSearch::countUnsafe(range.begin(), range.end());
+}
+
+char*
+StringUtils::urlencode(const Range &range, char *result) {
+	static const char HEX_DIGITS[] = "0123456789ABCDEF";
+	for (const char *i = range.begin(), *end = range.end(); i != end; ++i) {
+		const char *unsafe = ByteSearch::findUnsafe(i, end);
+		memcpy(result, i, unsafe - i);
+		result += unsafe - i;
+		if (unsafe == end) {
+			break;
+		}
+		unsigned char symbol = static_cast<unsigned char>(*unsafe);
+		*result++ = '%';
+		*result++ = HEX_DIGITS[symbol >> 4];
+		*result++ = HEX_DIGITS[symbol & 0x0F];
+		i = unsafe;
+	}
+	return result;
+}
+
+static inline int
+hexDigit(char c) {
+	return (c >= 'A') ? ((c & 0xDF) - 'A') + 10 : (c - '0');
+}
+
+// an escape cut by the end of a segment that is not the last one is left to be
+// decoded with the next segment, its start is returned then
+static const char*
+decodeSegment(const char *begin, const char *end, char *&result, bool last) {
+	for (const char *i = begin; i != end; ++i) {
+		// the result may be decoded in place
+		const char *escape = ByteSearch::findEscape(i, end);
+		memmove(result, i, escape - i);
+		result += escape - i;
+		if (escape == end) {
+			break;
+		}
+		i = escape;
+		if ('+' == *i) {
+			*result++ = ' ';
+		}
+		else if (std::distance(i, end) > 2) {
+			*result++ = static_cast<char>(hexDigit(*(i + 1)) * 16 + hexDigit(*(i + 2)));
+			i += 2;
 		}
-		switch (symbol) {
-			case '-': case '_': case '.': case '!': case '~': 
-			case '*': case '(': case ')': case '\'': 
-				result.append(1, symbol);
-				break;
-			default:
-				result.append(1, '%');
-				char bytes[3] = { 0, 0, 0 };
-				bytes[0] = (symbol & 0xF0) / 16 ;
-				bytes[0] += (bytes[0] > 9) ? 'A' - 10 : '0';
-				bytes[1] = symbol & 0x0F;
-				bytes[1] += (bytes[1] > 9) ? 'A' - 10 : '0';
-				result.append(bytes, sizeof(bytes) - 1);
-				break;
+		else if (!last) {
+			return i;
+		}
+		else {
+			*result++ = '%';
 		}
 	}
+	return end;
+}
+
+char*
+StringUtils::urldecode(const Range &range, char *result) {
+	decodeSegment(range.begin(), range.end(), result, true);
 	return result;
 }
 
 void
 StringUtils::urldecode(const Range &range, std::string &result) {
-	for (const char *i = range.begin(), *end = range.end(); i != end; ++i) {
-		switch (*i) {
-			case '+':
-				result.append(1, ' ');
-				break;
-			case '%':
-				if (std::distance(i, end) > 2) {
-					int digit;
-					char f = *(i + 1), s = *(i + 2);
-					digit = (f >= 'A' ? ((f & 0xDF) - 'A') + 10 : (f - '0')) * 16;
-					digit += (s >= 'A') ? ((s & 0xDF) - 'A') + 10 : (s - '0');
-					result.append(1, static_cast<char>(digit));
-					i += 2;
-				}
-				else {
-					result.append(1, '%');
-				}
-				break;
-			default:
-				result.append(1, (*i));
-				break;
-		}
-	}
+	const std::string::size_type size = result.size();
+	result.resize(size + range.size());
+	char *begin = &result[0];
+	result.resize(urldecode(range, begin + size) - begin);
 }
 
 std::string
@@ -91,56 +119,41 @@ StringUtils::urldecode(const Range &range) {
 
 std::string
 StringUtils::urldecode(DataBuffer data) {
-	std::string result;
-	result.reserve(data.size());
+	std::string result(data.size(), '\0');
+	char *out = &result[0];
+
+	// the bytes of an escape cut by the end of a segment
+	char escape[3];
+	std::size_t cut = 0;
 	for (DataBuffer::SegmentIterator it = data.begin(); it != data.end(); ++it) {
-		std::pair<char*, boost::uint64_t> chunk = *it;
-		urldecode(Range(chunk.first, chunk.first + chunk.second), result);
+		const char *pos = it->first, *end = pos + it->second;
+		if (cut) {
+			while (cut < sizeof(escape) && pos != end) {
+				escape[cut++] = *pos++;
+			}
+			if (cut < sizeof(escape)) {
+				continue;
+			}
+			decodeSegment(escape, escape + cut, out, true);
+			cut = 0;
+		}
+		const char *rest = decodeSegment(pos, end, out, false);
+		cut = end - rest;
+		memcpy(escape, rest, cut);
 	}
+	decodeSegment(escape, escape + cut, out, true);
+	result.resize(out - result.data());
 	return result;
 }
 
 void
 StringUtils::parse(const Range &range, std::vector<NamedValue> &v) {
-	
-	Range tmp = range;
-	while (!tmp.empty()) {
-		Range key, value, head, tail;
-		
-		tmp.split('&', head, tail);
-		head.split('=', key, value);
-		if (!key.empty()) {
-			try {
-				v.push_back(std::pair<std::string, std::string>(urldecode(key), urldecode(value)));
-			}
-			catch (const std::exception &e) {
-				throw;
-				// do we really want to swallow this exception here ???
-				// log()->error("%s, caught exception: %s", e.what());
-			}
-		}
-		tmp = tail;
-	}
+	Parser::parseArgs(range, v);
 }
 
 void
 StringUtils::parse(DataBuffer data, std::vector<NamedValue> &v) {
-
-	DataBuffer tmp = data;
-	while (!tmp.empty()) {
-		DataBuffer key, value, head, tail;
-		tmp.split('&', head, tail);
-		head.split('=', key, value);
-		if (!key.empty()) {
-			try {
-				v.push_back(std::pair<std::string, std::string>(urldecode(key), urldecode(value)));
-			}
-			catch (const std::exception &e) {
-				throw;
-			}
-		}
-		tmp = tail;
-	}
+	Parser::parseArgs(data, v);
 }
 
 void
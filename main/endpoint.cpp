@@ -2,11 +2,17 @@
 #include "settings.h"
 
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
 #include <cassert>
 #include <cerrno>
+#include <cstdlib>
+#include <cstring>
 #include <sstream>
-
-#include <fcgiapp.h>
+#include <stdexcept>
 
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
@@ -39,8 +45,10 @@ Endpoint::ScopedBusyCounter::decrement() {
 	}
 }
 
-Endpoint::Endpoint(const std::string &path, const std::string &port, unsigned short threads) :
-	socket_(-1), busy_count_(0), threads_(threads), socket_path_(path), socket_port_(port)
+Endpoint::Endpoint(const std::string &path, const std::string &port, unsigned short threads,
+	unsigned int idleTimeout, unsigned int maxRequests, const CpuSet &cpus) :
+	socket_(-1), busy_count_(0), threads_(threads), idle_timeout_(idleTimeout), max_requests_(maxRequests),
+	cpus_(cpus), socket_path_(path), socket_port_(port)
 {
 	if (socket_path_.empty() && socket_port_.empty()) {
 		throw std::runtime_error("Both /socket and /port param for endpoint is empty");
@@ -56,11 +64,42 @@ Endpoint::socket() const {
 	return socket_;
 }
 
+int
+Endpoint::accept() {
+	const int s = socket();
+	int fd = -1;
+	do {
+		fd = ::accept(s, NULL, NULL);
+	} while (-1 == fd && EINTR == errno);
+
+	if (-1 == fd) {
+		char buffer[256];
+		throw std::runtime_error(std::string("failed to accept fastcgi connection: ") +
+			strerror_r(errno, buffer, sizeof(buffer)));
+	}
+	return fd;
+}
+
 unsigned short
 Endpoint::threads() const {
 	return threads_;
 }
 
+unsigned int
+Endpoint::idleTimeout() const {
+	return idle_timeout_;
+}
+
+unsigned int
+Endpoint::maxRequests() const {
+	return max_requests_;
+}
+
+const CpuSet&
+Endpoint::cpus() const {
+	return cpus_;
+}
+
 std::string
 Endpoint::toString() const {
 	return socket_path_.empty() ? (std::string(":") + socket_port_) : socket_path_;
@@ -72,10 +111,58 @@ Endpoint::getBusyCounter() const {
 	return busy_count_;
 }
 
+static int
+listenSocket(int s, const sockaddr *addr, socklen_t size, int backlog) {
+	if (-1 == bind(s, addr, size) || -1 == listen(s, backlog)) {
+		int error = errno;
+		close(s);
+		errno = error;
+		return -1;
+	}
+	return s;
+}
+
+static int
+openTcpSocket(const std::string &port, int backlog) {
+	int s = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (-1 == s) {
+		return -1;
+	}
+	int one = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(port.c_str()));
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	return listenSocket(s, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr), backlog);
+}
+
+static int
+openUnixSocket(const std::string &path, int backlog) {
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	if (path.size() >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path.c_str(), path.size());
+
+	int s = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (-1 == s) {
+		return -1;
+	}
+	unlink(path.c_str());
+	return listenSocket(s, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr), backlog);
+}
+
 void
 Endpoint::openSocket(const int backlog) {
 	boost::mutex::scoped_lock sl(mutex_);
-	socket_ = FCGX_OpenSocket(toString().c_str(), backlog);
+	socket_ = socket_path_.empty() ?
+		openTcpSocket(socket_port_, backlog) : openUnixSocket(socket_path_, backlog);
 	if (-1 == socket_) {
 		std::stringstream stream;
 		stream << "can not open fastcgi socket: " << toString() << "[" << errno << "]";
@@ -2,6 +2,8 @@
 
 #include <boost/thread/mutex.hpp>
 
+#include "details/cpu_set.h"
+
 namespace fastcgi {
 
 class Endpoint {
@@ -18,12 +20,17 @@ public:
 	};
 
 public:
-	Endpoint(const std::string &path, const std::string &port, unsigned short threads);
+	Endpoint(const std::string &path, const std::string &port, unsigned short threads,
+		unsigned int idleTimeout, unsigned int maxRequests, const CpuSet &cpus);
 	virtual ~Endpoint();
 
 	int socket() const;
+	int accept();
 
 	unsigned short threads() const;
+	unsigned int idleTimeout() const;
+	unsigned int maxRequests() const;
+	const CpuSet& cpus() const;
 
 	std::string toString() const;
 	unsigned short getBusyCounter() const;
@@ -37,6 +44,8 @@ private:
 	int socket_;
 	int busy_count_;
 	unsigned short threads_;
+	unsigned int idle_timeout_, max_requests_;
+	CpuSet cpus_;
 	mutable boost::mutex mutex_;
 	std::string socket_path_, socket_port_;
 };
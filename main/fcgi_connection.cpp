@@ -0,0 +1,678 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "fcgi_connection.h"
+#include "endpoint.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+static const std::string MPXS_CONNS_NAME = "FCGI_MPXS_CONNS";
+static const std::size_t RECEIVE_BUFFER_SIZE = 16384;
+static const std::size_t MIN_BODY_CHUNK_SIZE = 4096;
+static const std::size_t MAX_BODY_CHUNK_SIZE = 65536;
+
+static time_t
+monotonicTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+FastcgiRequestData::FastcgiRequestData(unsigned short id, bool keepConnection) :
+    id(id), keepConnection(keepConnection), paramsComplete(false), body_pos_(0), chunk_size_(MIN_BODY_CHUNK_SIZE),
+    body_complete_(false),
+    aborted_(false), streamed_(false)
+{}
+
+void
+FastcgiRequestData::appendBody(const char *data, std::size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (aborted_) {
+        return;
+    }
+    while (size > 0) {
+        if (body_.empty() || body_.back().size() == body_.back().capacity()) {
+            // chunks grow with the body, so a small one takes little memory
+            body_.push_back(std::vector<char>());
+            body_.back().reserve(chunk_size_);
+            chunk_size_ = std::min(2 * chunk_size_, MAX_BODY_CHUNK_SIZE);
+        }
+        std::vector<char> &chunk = body_.back();
+        const std::size_t len = std::min(size, chunk.capacity() - chunk.size());
+        chunk.insert(chunk.end(), data, data + len);
+        data += len;
+        size -= len;
+    }
+    if (streamed_) {
+        condition_.notify_all();
+    }
+}
+
+void
+FastcgiRequestData::completeBody() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    body_complete_ = true;
+    condition_.notify_all();
+}
+
+void
+FastcgiRequestData::abort() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    aborted_ = true;
+    body_.clear();
+    body_pos_ = 0;
+    condition_.notify_all();
+}
+
+bool
+FastcgiRequestData::stream() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    streamed_ = !aborted_;
+    return streamed_;
+}
+
+std::size_t
+FastcgiRequestData::readBody(char *buf, std::size_t size) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (body_.empty() && !body_complete_ && !aborted_) {
+        condition_.wait(lock);
+    }
+    if (aborted_) {
+        throw std::runtime_error("request was aborted while its body was read");
+    }
+    std::size_t len = 0;
+    while (len < size && !body_.empty()) {
+        std::vector<char> &chunk = body_.front();
+        const std::size_t piece = std::min(size - len, chunk.size() - body_pos_);
+        memcpy(buf + len, &chunk[body_pos_], piece);
+        len += piece;
+        body_pos_ += piece;
+        if (body_pos_ == chunk.size()) {
+            body_.pop_front();
+            body_pos_ = 0;
+        }
+    }
+    return len;
+}
+
+bool
+FastcgiRequestData::bodyComplete() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return body_complete_;
+}
+
+bool
+FastcgiRequestData::streamed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streamed_;
+}
+
+FastcgiConnection::FastcgiConnection(int fd, Endpoint *endpoint, bool multiplexed) :
+    fd_(fd), endpoint_(endpoint), multiplexed_(multiplexed), reader_(std::this_thread::get_id()), state_(READ_HEADER), header_size_(0),
+    content_left_(0), padding_left_(0), content_target_(NULL), content_body_(false), requests_(0), last_read_(monotonicTime()),
+    closing_(false), last_active_(monotonicTime()), shutdown_pending_(false)
+{
+    endpoint_->incrementBusyCounter();
+}
+
+FastcgiConnection::~FastcgiConnection() {
+    close(fd_);
+    endpoint_->decrementBusyCounter();
+}
+
+int
+FastcgiConnection::fd() const {
+    return fd_;
+}
+
+Endpoint*
+FastcgiConnection::endpoint() const {
+    return endpoint_;
+}
+
+bool
+FastcgiConnection::consume(const char *data, std::size_t size, RequestList &ready) {
+    last_read_ = monotonicTime();
+    while (size > 0) {
+        std::size_t len = 0;
+        switch (state_) {
+            case READ_HEADER:
+                len = std::min(FastcgiRecord::HEADER_SIZE - header_size_, size);
+                memcpy(header_ + header_size_, data, len);
+                header_size_ += len;
+                if (FastcgiRecord::HEADER_SIZE == header_size_) {
+                    header_size_ = 0;
+                    if (!startRecord()) {
+                        return false;
+                    }
+                    if (0 == content_left_) {
+                        if (!completeRecord(ready)) {
+                            return false;
+                        }
+                        state_ = padding_left_ ? READ_PADDING : READ_HEADER;
+                    }
+                    else {
+                        state_ = READ_CONTENT;
+                    }
+                }
+                break;
+            case READ_CONTENT:
+                len = std::min(content_left_, size);
+                if (content_body_) {
+                    current_->appendBody(data, len);
+                }
+                else if (content_target_) {
+                    content_target_->insert(content_target_->end(), data, data + len);
+                }
+                content_left_ -= len;
+                if (0 == content_left_) {
+                    if (!completeRecord(ready)) {
+                        return false;
+                    }
+                    state_ = padding_left_ ? READ_PADDING : READ_HEADER;
+                }
+                break;
+            case READ_PADDING:
+                len = std::min(padding_left_, size);
+                padding_left_ -= len;
+                if (0 == padding_left_) {
+                    state_ = READ_HEADER;
+                }
+                break;
+        }
+        data += len;
+        size -= len;
+    }
+    return true;
+}
+
+boost::shared_ptr<FastcgiRequestData>
+FastcgiConnection::receive() {
+    char buffer[RECEIVE_BUFFER_SIZE];
+    flushControl(true);
+    while (received_.empty()) {
+        if (!waitReadable()) {
+            return boost::shared_ptr<FastcgiRequestData>();
+        }
+        ssize_t res = ::read(fd_, buffer, sizeof(buffer));
+        if (res < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            char error[256];
+            throw std::runtime_error(std::string("failed to read fastcgi request: ") +
+                strerror_r(errno, error, sizeof(error)));
+        }
+        if (0 == res) {
+            return boost::shared_ptr<FastcgiRequestData>();
+        }
+        RequestList ready;
+        if (!consume(buffer, res, ready)) {
+            throw std::runtime_error("malformed fastcgi record");
+        }
+        flushControl(true);
+        received_.insert(received_.end(), ready.begin(), ready.end());
+    }
+    boost::shared_ptr<FastcgiRequestData> data = received_.front();
+    received_.pop_front();
+    return data;
+}
+
+bool
+FastcgiConnection::expired() const {
+    const unsigned int timeout = endpoint_->idleTimeout();
+    if (0 == timeout) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    // a request with its handler keeps the connection, one whose params or
+    // body have stopped arriving does not
+    for (std::set<unsigned short>::const_iterator i = active_.begin(); i != active_.end(); ++i) {
+        if (0 == reading_.count(*i)) {
+            return false;
+        }
+    }
+    return monotonicTime() - std::max(last_active_, last_read_) >= static_cast<time_t>(timeout);
+}
+
+bool
+FastcgiConnection::waitReadable() {
+    const unsigned int timeout = endpoint_->idleTimeout();
+    if (0 == timeout) {
+        return true;
+    }
+    while (true) {
+        struct pollfd pfd;
+        pfd.fd = fd_;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        const int res = poll(&pfd, 1, timeout * 1000);
+        if (res > 0) {
+            return true;
+        }
+        if (res < 0 && EINTR != errno) {
+            char error[256];
+            throw std::runtime_error(std::string("failed to wait for fastcgi request: ") +
+                strerror_r(errno, error, sizeof(error)));
+        }
+        if (expired()) {
+            return false;
+        }
+    }
+}
+
+bool
+FastcgiConnection::startRecord() {
+    record_ = FastcgiRecord::parseHeader(header_);
+    if (FastcgiRecord::PROTOCOL_VERSION != record_.version) {
+        return false;
+    }
+    content_left_ = record_.contentLength;
+    padding_left_ = record_.paddingLength;
+    content_.clear();
+
+    if (FastcgiRecord::PARAMS == record_.type || FastcgiRecord::STDIN == record_.type) {
+        std::map<unsigned short, boost::shared_ptr<FastcgiRequestData> >::iterator it =
+            reading_.find(record_.requestId);
+        if (reading_.end() == it) {
+            current_.reset();
+        }
+        else {
+            current_ = it->second;
+        }
+    }
+    const bool current = current_ && current_->id == record_.requestId;
+    content_body_ = false;
+    switch (record_.type) {
+        case FastcgiRecord::PARAMS:
+            content_target_ = (current && !current_->paramsComplete) ? &current_->params : NULL;
+            break;
+        case FastcgiRecord::STDIN:
+            content_target_ = NULL;
+            content_body_ = current && current_->paramsComplete;
+            break;
+        case FastcgiRecord::DATA:
+            content_target_ = NULL;
+            break;
+        default:
+            content_target_ = &content_;
+            break;
+    }
+    return true;
+}
+
+bool
+FastcgiConnection::completeRecord(RequestList &ready) {
+    const bool current = current_ && current_->id == record_.requestId;
+    switch (record_.type) {
+        case FastcgiRecord::BEGIN_REQUEST:
+            if (FastcgiRecord::BEGIN_REQUEST_BODY_SIZE > content_.size() || 0 == record_.requestId) {
+                return false;
+            }
+            beginRequest(record_.requestId);
+            break;
+        case FastcgiRecord::ABORT_REQUEST:
+            abortRequest(record_.requestId);
+            break;
+        case FastcgiRecord::PARAMS:
+            if (current && !current_->paramsComplete && 0 == record_.contentLength) {
+                current_->paramsComplete = true;
+                ready.push_back(current_);
+            }
+            break;
+        case FastcgiRecord::STDIN:
+            if (current && current_->paramsComplete && 0 == record_.contentLength) {
+                current_->completeBody();
+                // a streamed request is with its handler already, a request reported
+                // at params complete in this same batch is not reported twice
+                if (!current_->streamed() && std::find(ready.begin(), ready.end(), current_) == ready.end()) {
+                    ready.push_back(current_);
+                }
+                reading_.erase(current_->id);
+                current_.reset();
+            }
+            break;
+        case FastcgiRecord::GET_VALUES:
+            if (0 == record_.requestId) {
+                getValues();
+            }
+            break;
+        case FastcgiRecord::DATA:
+            break;
+        default:
+            if (0 == record_.requestId) {
+                char body[8] = { static_cast<char>(record_.type), 0, 0, 0, 0, 0, 0, 0 };
+                queueControl(FastcgiRecord::UNKNOWN_TYPE, 0, body, sizeof(body));
+            }
+            break;
+    }
+    return true;
+}
+
+void
+FastcgiConnection::beginRequest(unsigned short requestId) {
+    const unsigned char *body = reinterpret_cast<const unsigned char*>(&content_[0]);
+    const unsigned short role = (body[0] << 8) | body[1];
+    const bool keepConnection = 0 != (body[2] & FastcgiRecord::KEEP_CONN);
+
+    if (FastcgiRecord::RESPONDER != role) {
+        endRequest(requestId, FastcgiRecord::UNKNOWN_ROLE);
+        return;
+    }
+    bool busy = false, duplicate = false, closing = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        duplicate = active_.count(requestId) > 0;
+        busy = !multiplexed_ && !active_.empty();
+        closing = closing_;
+        if (!busy && !duplicate && !closing) {
+            active_.insert(requestId);
+            const unsigned int maxRequests = endpoint_->maxRequests();
+            closing_ = maxRequests && ++requests_ >= maxRequests;
+        }
+    }
+    if (duplicate) {
+        return;
+    }
+    if (busy || closing) {
+        endRequest(requestId, busy ? FastcgiRecord::CANT_MPX_CONN : FastcgiRecord::OVERLOADED);
+        return;
+    }
+    reading_[requestId].reset(new FastcgiRequestData(requestId, keepConnection));
+}
+
+void
+FastcgiConnection::abortRequest(unsigned short requestId) {
+    std::map<unsigned short, boost::shared_ptr<FastcgiRequestData> >::iterator it = reading_.find(requestId);
+    if (reading_.end() == it) {
+        return;
+    }
+    const bool keepConnection = it->second->keepConnection;
+    const bool streamed = it->second->streamed();
+    if (current_ == it->second) {
+        current_.reset();
+    }
+    it->second->abort();
+    if (streamed) {
+        // the handler ends the request when it sees the abort
+        reading_.erase(it);
+        return;
+    }
+    reading_.erase(it);
+    endRequest(requestId, FastcgiRecord::REQUEST_COMPLETE);
+    release(requestId, keepConnection);
+}
+
+void
+FastcgiConnection::abortReading() {
+    for (std::map<unsigned short, boost::shared_ptr<FastcgiRequestData> >::iterator i = reading_.begin();
+         i != reading_.end();
+         ++i) {
+        i->second->abort();
+    }
+    reading_.clear();
+    received_.clear();
+    current_.reset();
+}
+
+void
+FastcgiConnection::getValues() {
+    std::string result;
+    const char *pos = content_.empty() ? NULL : &content_[0];
+    const char *end = pos + content_.size();
+    while (pos != end) {
+        Range name, value;
+        if (!FastcgiRecord::parseNameValue(pos, end, name, value)) {
+            break;
+        }
+        if (Range::fromString(MPXS_CONNS_NAME) == name) {
+            FastcgiRecord::formatNameValue(MPXS_CONNS_NAME, multiplexed_ ? "1" : "0", result);
+        }
+    }
+    queueControl(FastcgiRecord::GET_VALUES_RESULT, 0, result.data(), result.size());
+}
+
+void
+FastcgiConnection::write(unsigned char type, unsigned short requestId, const char *data, std::size_t size) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(data);
+    iov.iov_len = size;
+    sendRecords(type, requestId, &iov, 1, NULL, 0);
+}
+
+void
+FastcgiConnection::write(unsigned char type, unsigned short requestId, const struct iovec *data, int count) {
+    sendRecords(type, requestId, data, count, NULL, 0);
+}
+
+void
+FastcgiConnection::finishRequest(unsigned short requestId, bool keepConnection,
+        const struct iovec *data, int count) {
+    char records[2 * FastcgiRecord::HEADER_SIZE + FastcgiRecord::END_REQUEST_BODY_SIZE];
+    FastcgiRecord::formatHeader(records, FastcgiRecord::STDOUT, requestId, 0);
+    FastcgiRecord::formatEndRequest(records + FastcgiRecord::HEADER_SIZE, requestId, 0,
+        FastcgiRecord::REQUEST_COMPLETE);
+
+    try {
+        sendRecords(FastcgiRecord::STDOUT, requestId, data, count, records, sizeof(records));
+    }
+    catch (...) {
+        release(requestId, false);
+        throw;
+    }
+    release(requestId, keepConnection);
+}
+
+void
+FastcgiConnection::release(unsigned short requestId, bool keepConnection) {
+    bool close = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active_.erase(requestId);
+        last_active_ = monotonicTime();
+        // other requests of a multiplexed connection are answered before it is closed
+        closing_ = closing_ || !keepConnection;
+        close = closing_ && active_.empty();
+    }
+    if (close) {
+        // queued records still go out before the connection is shut down
+        std::lock_guard<std::mutex> lock(control_mutex_);
+        if (control_.empty()) {
+            shutdown(fd_, SHUT_RDWR);
+        }
+        else {
+            shutdown_pending_ = true;
+        }
+    }
+}
+
+void
+FastcgiConnection::endRequest(unsigned short requestId, unsigned char protocolStatus) {
+    char record[FastcgiRecord::HEADER_SIZE + FastcgiRecord::END_REQUEST_BODY_SIZE];
+    FastcgiRecord::formatEndRequest(record, requestId, 0, protocolStatus);
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    control_.append(record, sizeof(record));
+}
+
+void
+FastcgiConnection::queueControl(unsigned char type, unsigned short requestId, const char *data, std::size_t size) {
+    char header[FastcgiRecord::HEADER_SIZE];
+    FastcgiRecord::formatHeader(header, type, requestId, size);
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    control_.append(header, sizeof(header));
+    control_.append(data, size);
+}
+
+bool
+FastcgiConnection::flushControl(bool wait) {
+    if (wait) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        return sendControl(true);
+    }
+    // a response being written goes on undisturbed, its writer sends the queue after it
+    std::unique_lock<std::mutex> lock(write_mutex_, std::try_to_lock);
+    return lock.owns_lock() && sendControl(false);
+}
+
+bool
+FastcgiConnection::sendControl(bool wait) {
+    std::unique_lock<std::mutex> lock(control_mutex_);
+    while (!control_.empty()) {
+        if (wait) {
+            std::string control;
+            control.swap(control_);
+            lock.unlock();
+            struct iovec iov;
+            iov.iov_base = &control[0];
+            iov.iov_len = control.size();
+            send(&iov, 1);
+            lock.lock();
+            continue;
+        }
+        ssize_t res = ::send(fd_, control_.data(), control_.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (res < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                return false;
+            }
+            char buffer[256];
+            throw std::runtime_error(strerror_r(errno, buffer, sizeof(buffer)));
+        }
+        control_.erase(0, res);
+    }
+    if (shutdown_pending_) {
+        shutdown_pending_ = false;
+        shutdown(fd_, SHUT_RDWR);
+    }
+    return true;
+}
+
+void
+FastcgiConnection::queueRecords(unsigned char type, unsigned short requestId, const struct iovec *data, int count,
+        const char *trailer, std::size_t trailerSize) {
+    char header[FastcgiRecord::HEADER_SIZE];
+    std::lock_guard<std::mutex> lock(control_mutex_);
+    for (int i = 0; i < count; ++i) {
+        const char *pos = static_cast<const char*>(data[i].iov_base);
+        for (std::size_t left = data[i].iov_len; left > 0; ) {
+            const std::size_t len = std::min(left, FastcgiRecord::MAX_CONTENT_SIZE);
+            FastcgiRecord::formatHeader(header, type, requestId, len);
+            control_.append(header, sizeof(header));
+            control_.append(pos, len);
+            pos += len;
+            left -= len;
+        }
+    }
+    if (trailer) {
+        control_.append(trailer, trailerSize);
+    }
+}
+
+void
+FastcgiConnection::sendRecords(unsigned char type, unsigned short requestId, const struct iovec *data, int count,
+        const char *trailer, std::size_t trailerSize) {
+    if (std::this_thread::get_id() == reader_) {
+        queueRecords(type, requestId, data, count, trailer, trailerSize);
+        return;
+    }
+    // a record header and at least one piece of its content, the trailer goes last
+    const int IOVECS_PER_CALL = 64;
+    char headers[IOVECS_PER_CALL / 2][FastcgiRecord::HEADER_SIZE];
+    struct iovec iov[IOVECS_PER_CALL + 1];
+
+    int index = 0;
+    std::size_t offset = 0;
+    bool done = false;
+    while (!done) {
+        int used = 0, records = 0;
+        while (used + 2 <= IOVECS_PER_CALL) {
+            while (index < count && offset == data[index].iov_len) {
+                ++index;
+                offset = 0;
+            }
+            if (index == count) {
+                break;
+            }
+            const int header = used++;
+            std::size_t len = 0;
+            while (index < count && used < IOVECS_PER_CALL && len < FastcgiRecord::MAX_CONTENT_SIZE) {
+                const std::size_t piece = std::min(data[index].iov_len - offset, FastcgiRecord::MAX_CONTENT_SIZE - len);
+                iov[used].iov_base = static_cast<char*>(data[index].iov_base) + offset;
+                iov[used].iov_len = piece;
+                ++used;
+                len += piece;
+                offset += piece;
+                while (index < count && offset == data[index].iov_len) {
+                    ++index;
+                    offset = 0;
+                }
+            }
+            FastcgiRecord::formatHeader(headers[records], type, requestId, len);
+            iov[header].iov_base = headers[records];
+            iov[header].iov_len = FastcgiRecord::HEADER_SIZE;
+            ++records;
+        }
+        done = index == count;
+        if (done && trailer) {
+            iov[used].iov_base = const_cast<char*>(trailer);
+            iov[used].iov_len = trailerSize;
+            ++used;
+        }
+        if (used) {
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            send(iov, used);
+            sendControl(true);
+        }
+    }
+}
+
+void
+FastcgiConnection::send(struct iovec *iov, int count) {
+    while (count > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t res = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        if (res < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno) {
+                struct pollfd pfd;
+                pfd.fd = fd_;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            char buffer[256];
+            throw std::runtime_error(strerror_r(errno, buffer, sizeof(buffer)));
+        }
+        while (count > 0 && static_cast<std::size_t>(res) >= iov->iov_len) {
+            res -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + res;
+            iov->iov_len -= res;
+        }
+    }
+}
+
+} // namespace fastcgi
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <ctime>
+
+#include <sys/uio.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fcgi_protocol.h"
+
+namespace fastcgi {
+
+class Endpoint;
+
+/**
+ * A request as the connection reads it. The connection hands it out when its
+ * body is complete and, before that, once its params are complete, so that a
+ * request may be taken before its body arrives. The body of such a streamed
+ * request is then filled by the connection while a pool thread reads it. The
+ * part of any body already read is dropped, and so is the rest once the
+ * request is aborted.
+ */
+struct FastcgiRequestData {
+    FastcgiRequestData(unsigned short id, bool keepConnection);
+
+    // called by the thread reading the connection
+    void appendBody(const char *data, std::size_t size);
+    void completeBody();
+    void abort();
+    // false when the request is aborted already
+    bool stream();
+
+    // blocks until a part of the body arrives, returns 0 at its end
+    std::size_t readBody(char *buf, std::size_t size);
+    bool bodyComplete() const;
+    bool streamed() const;
+
+    unsigned short id;
+    bool keepConnection;
+    bool paramsComplete;
+    std::vector<char> params;
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable condition_;
+    // chunks are filled up to their capacity and never reallocated
+    std::deque<std::vector<char> > body_;
+    std::size_t body_pos_;
+    std::size_t chunk_size_;
+    bool body_complete_;
+    bool aborted_;
+    bool streamed_;
+};
+
+/**
+ * FastCGI connection. Records are assembled by the thread that owns the socket,
+ * either from a reactor (consume) or by blocking reads (receive), while
+ * responses may be written from any thread. The reading thread never waits for
+ * the socket to become writable: its own replies, including responses it
+ * writes itself, are queued until it can.
+ *
+ * Connections stay open after requests sent with FCGI_KEEP_CONN until they are
+ * idle for the endpoint idle timeout or have served max requests. Multiplexed
+ * connections also accept several concurrent request ids.
+ */
+class FastcgiConnection : private boost::noncopyable {
+public:
+    typedef std::vector<boost::shared_ptr<FastcgiRequestData> > RequestList;
+
+    FastcgiConnection(int fd, Endpoint *endpoint, bool multiplexed);
+    ~FastcgiConnection();
+
+    int fd() const;
+    Endpoint* endpoint() const;
+
+    bool consume(const char *data, std::size_t size, RequestList &ready);
+    boost::shared_ptr<FastcgiRequestData> receive();
+    // called by the thread reading the connection
+    bool expired() const;
+
+    // aborts the requests the connection has not read yet when it stops reading
+    void abortReading();
+
+    // records the connection answers by itself while reading are queued and
+    // sent here, false when some are left because the socket is full or a
+    // response is being written at the moment
+    bool flushControl(bool wait);
+
+    void write(unsigned char type, unsigned short requestId, const char *data, std::size_t size);
+    // the content is split into records that refer to it, the record headers
+    // are interleaved with it and all go out in as few sendmsg calls as fit
+    void write(unsigned char type, unsigned short requestId, const struct iovec *data, int count);
+    // sends the last output of the request in the same call as the end of the request
+    void finishRequest(unsigned short requestId, bool keepConnection,
+        const struct iovec *data = NULL, int count = 0);
+
+private:
+    enum ReadState {
+        READ_HEADER, READ_CONTENT, READ_PADDING
+    };
+
+    bool startRecord();
+    bool completeRecord(RequestList &ready);
+    void beginRequest(unsigned short requestId);
+    void abortRequest(unsigned short requestId);
+    void getValues();
+
+    void release(unsigned short requestId, bool keepConnection);
+    void endRequest(unsigned short requestId, unsigned char protocolStatus);
+    void queueControl(unsigned char type, unsigned short requestId, const char *data, std::size_t size);
+    void queueRecords(unsigned char type, unsigned short requestId, const struct iovec *data, int count,
+        const char *trailer, std::size_t trailerSize);
+    bool sendControl(bool wait);
+    void sendRecords(unsigned char type, unsigned short requestId, const struct iovec *data, int count,
+        const char *trailer, std::size_t trailerSize);
+    void send(struct iovec *iov, int count);
+    bool waitReadable();
+
+private:
+    int fd_;
+    Endpoint *endpoint_;
+    const bool multiplexed_;
+    // the thread that creates the connection is the one reading it
+    const std::thread::id reader_;
+
+    ReadState state_;
+    char header_[FastcgiRecord::HEADER_SIZE];
+    std::size_t header_size_;
+    FastcgiRecord record_;
+    std::size_t content_left_;
+    std::size_t padding_left_;
+    std::vector<char> *content_target_;
+    bool content_body_;
+    std::vector<char> content_;
+    boost::shared_ptr<FastcgiRequestData> current_;
+    std::map<unsigned short, boost::shared_ptr<FastcgiRequestData> > reading_;
+    std::deque<boost::shared_ptr<FastcgiRequestData> > received_;
+    unsigned int requests_;
+    time_t last_read_;
+
+    mutable std::mutex mutex_;
+    std::set<unsigned short> active_;
+    bool closing_;
+    time_t last_active_;
+    std::mutex write_mutex_;
+    std::mutex control_mutex_;
+    std::string control_;
+    bool shutdown_pending_;
+};
+
+} // namespace fastcgi
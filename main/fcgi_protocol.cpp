@@ -0,0 +1,112 @@
+#include "settings.h"
+
+#include "fcgi_protocol.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+const unsigned char FastcgiRecord::PROTOCOL_VERSION;
+const unsigned short FastcgiRecord::RESPONDER;
+const unsigned char FastcgiRecord::KEEP_CONN;
+const std::size_t FastcgiRecord::HEADER_SIZE;
+const std::size_t FastcgiRecord::BEGIN_REQUEST_BODY_SIZE;
+const std::size_t FastcgiRecord::END_REQUEST_BODY_SIZE;
+const std::size_t FastcgiRecord::MAX_CONTENT_SIZE;
+
+static bool
+parseLength(const char *&pos, const char *end, boost::uint32_t &length) {
+    if (pos == end) {
+        return false;
+    }
+    const unsigned char *data = reinterpret_cast<const unsigned char*>(pos);
+    if (0 == (data[0] & 0x80)) {
+        length = data[0];
+        pos += 1;
+        return true;
+    }
+    if (end - pos < 4) {
+        return false;
+    }
+    length = ((data[0] & 0x7F) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+    pos += 4;
+    return true;
+}
+
+static void
+formatLength(std::size_t length, std::string &result) {
+    if (length < 0x80) {
+        result.push_back(static_cast<char>(length));
+        return;
+    }
+    result.push_back(static_cast<char>(((length >> 24) & 0x7F) | 0x80));
+    result.push_back(static_cast<char>((length >> 16) & 0xFF));
+    result.push_back(static_cast<char>((length >> 8) & 0xFF));
+    result.push_back(static_cast<char>(length & 0xFF));
+}
+
+FastcgiRecord
+FastcgiRecord::parseHeader(const char *data) {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+    FastcgiRecord record;
+    record.version = bytes[0];
+    record.type = bytes[1];
+    record.requestId = (bytes[2] << 8) | bytes[3];
+    record.contentLength = (bytes[4] << 8) | bytes[5];
+    record.paddingLength = bytes[6];
+    return record;
+}
+
+void
+FastcgiRecord::formatHeader(char *data, unsigned char type, unsigned short requestId,
+    unsigned short contentLength, unsigned char paddingLength) {
+    data[0] = PROTOCOL_VERSION;
+    data[1] = type;
+    data[2] = static_cast<char>((requestId >> 8) & 0xFF);
+    data[3] = static_cast<char>(requestId & 0xFF);
+    data[4] = static_cast<char>((contentLength >> 8) & 0xFF);
+    data[5] = static_cast<char>(contentLength & 0xFF);
+    data[6] = paddingLength;
+    data[7] = 0;
+}
+
+void
+FastcgiRecord::formatEndRequest(char *data, unsigned short requestId,
+    boost::uint32_t appStatus, unsigned char protocolStatus) {
+    formatHeader(data, END_REQUEST, requestId, END_REQUEST_BODY_SIZE);
+    char *body = data + HEADER_SIZE;
+    body[0] = static_cast<char>((appStatus >> 24) & 0xFF);
+    body[1] = static_cast<char>((appStatus >> 16) & 0xFF);
+    body[2] = static_cast<char>((appStatus >> 8) & 0xFF);
+    body[3] = static_cast<char>(appStatus & 0xFF);
+    body[4] = protocolStatus;
+    body[5] = body[6] = body[7] = 0;
+}
+
+bool
+FastcgiRecord::parseNameValue(const char *&pos, const char *end, Range &name, Range &value) {
+    const char *cur = pos;
+    boost::uint32_t nameLength = 0, valueLength = 0;
+    if (!parseLength(cur, end, nameLength) || !parseLength(cur, end, valueLength)) {
+        return false;
+    }
+    const boost::uint64_t available = end - cur;
+    if (available < static_cast<boost::uint64_t>(nameLength) + valueLength) {
+        return false;
+    }
+    name = Range(cur, cur + nameLength);
+    value = Range(cur + nameLength, cur + nameLength + valueLength);
+    pos = cur + nameLength + valueLength;
+    return true;
+}
+
+void
+FastcgiRecord::formatNameValue(const std::string &name, const std::string &value, std::string &result) {
+    formatLength(name.size(), result);
+    formatLength(value.size(), result);
+    result.append(name).append(value);
+}
+
+} // namespace fastcgi
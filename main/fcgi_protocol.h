@@ -0,0 +1,62 @@
+#pragma once
+
+#include <boost/cstdint.hpp>
+
+#include <cstddef>
+#include <string>
+
+#include "details/range.h"
+
+namespace fastcgi {
+
+/**
+ * FastCGI wire format helpers (see FastCGI Specification 1.0, section 8)
+ */
+struct FastcgiRecord {
+    enum Type {
+        BEGIN_REQUEST = 1,
+        ABORT_REQUEST = 2,
+        END_REQUEST = 3,
+        PARAMS = 4,
+        STDIN = 5,
+        STDOUT = 6,
+        STDERR = 7,
+        DATA = 8,
+        GET_VALUES = 9,
+        GET_VALUES_RESULT = 10,
+        UNKNOWN_TYPE = 11
+    };
+
+    enum ProtocolStatus {
+        REQUEST_COMPLETE = 0,
+        CANT_MPX_CONN = 1,
+        OVERLOADED = 2,
+        UNKNOWN_ROLE = 3
+    };
+
+    static const unsigned char PROTOCOL_VERSION = 1;
+    static const unsigned short RESPONDER = 1;
+    static const unsigned char KEEP_CONN = 1;
+
+    static const std::size_t HEADER_SIZE = 8;
+    static const std::size_t BEGIN_REQUEST_BODY_SIZE = 8;
+    static const std::size_t END_REQUEST_BODY_SIZE = 8;
+    static const std::size_t MAX_CONTENT_SIZE = 65535;
+
+    unsigned char version;
+    unsigned char type;
+    unsigned short requestId;
+    unsigned short contentLength;
+    unsigned char paddingLength;
+
+    static FastcgiRecord parseHeader(const char *data);
+    static void formatHeader(char *data, unsigned char type, unsigned short requestId,
+        unsigned short contentLength, unsigned char paddingLength = 0);
+    static void formatEndRequest(char *data, unsigned short requestId,
+        boost::uint32_t appStatus, unsigned char protocolStatus);
+
+    static bool parseNameValue(const char *&pos, const char *end, Range &name, Range &value);
+    static void formatNameValue(const std::string &name, const std::string &value, std::string &result);
+};
+
+} // namespace fastcgi
@@ -0,0 +1,273 @@
+#include "settings.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include "endpoint.h"
+#include "fcgi_connection.h"
+#include "fcgi_reactor.h"
+
+#include "fastcgi2/logger.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+static const int MAX_EVENTS = 256;
+static const int MAX_ACCEPTS_PER_EVENT = 64;
+static const int MAX_READS_PER_EVENT = 4;
+static const std::size_t READ_BUFFER_SIZE = 65536;
+static const int EXPIRE_INTERVAL = 1000;
+
+static time_t
+monotonicTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+FastcgiReactor::FastcgiReactor(const std::vector<boost::shared_ptr<Endpoint> > &endpoints,
+    HandlerType handler, Logger *logger) :
+    epoll_(-1), wakeup_(-1), stopped_(false), handler_(handler), logger_(logger),
+    expiring_(false), last_expire_(monotonicTime()), buffer_(READ_BUFFER_SIZE)
+{
+    epoll_ = epoll_create1(EPOLL_CLOEXEC);
+    if (-1 == epoll_) {
+        throw std::runtime_error("Cannot create epoll instance");
+    }
+    wakeup_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (-1 == wakeup_) {
+        close(epoll_);
+        throw std::runtime_error("Cannot create reactor wakeup descriptor");
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = wakeup_;
+    epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_, &event);
+
+    for (std::vector<boost::shared_ptr<Endpoint> >::const_iterator i = endpoints.begin();
+         i != endpoints.end();
+         ++i) {
+        const int fd = (*i)->socket();
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+        event.events |= EPOLLEXCLUSIVE;
+#endif
+        event.data.fd = fd;
+        if (-1 == epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event)) {
+            close(wakeup_);
+            close(epoll_);
+            throw std::runtime_error("Cannot watch endpoint " + (*i)->toString());
+        }
+        listeners_[fd] = i->get();
+        expiring_ = expiring_ || (*i)->idleTimeout() > 0;
+    }
+}
+
+FastcgiReactor::~FastcgiReactor() {
+    connections_.clear();
+    close(wakeup_);
+    close(epoll_);
+}
+
+void
+FastcgiReactor::stop() {
+    stopped_ = true;
+    boost::uint64_t one = 1;
+    ::write(wakeup_, &one, sizeof(one));
+}
+
+void
+FastcgiReactor::run() {
+    struct epoll_event events[MAX_EVENTS];
+    while (!stopped_) {
+        int count = epoll_wait(epoll_, events, MAX_EVENTS, expiring_ ? EXPIRE_INTERVAL : -1);
+        if (-1 == count) {
+            if (EINTR != errno) {
+                logger_->error("epoll_wait failed, errno = %i", errno);
+            }
+            continue;
+        }
+        if (expiring_ && monotonicTime() != last_expire_) {
+            closeExpiredConnections();
+        }
+        for (int i = 0; i < count && !stopped_; ++i) {
+            const int fd = events[i].data.fd;
+            if (wakeup_ == fd) {
+                continue;
+            }
+            std::map<int, Endpoint*>::iterator listener = listeners_.find(fd);
+            if (listeners_.end() != listener) {
+                acceptConnections(listener->second);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                writeConnection(fd);
+            }
+            if (events[i].events & ~EPOLLOUT) {
+                readConnection(fd);
+            }
+        }
+    }
+
+    // handlers streaming a body get no more of it
+    for (std::unordered_map<int, boost::shared_ptr<FastcgiConnection> >::iterator i = connections_.begin();
+         i != connections_.end();
+         ++i) {
+        i->second->abortReading();
+    }
+}
+
+void
+FastcgiReactor::acceptConnections(Endpoint *endpoint) {
+    for (int i = 0; i < MAX_ACCEPTS_PER_EVENT; ++i) {
+        int fd = accept4(endpoint->socket(), NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (-1 == fd) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+                logger_->error("cannot accept connection on %s, errno = %i",
+                    endpoint->toString().c_str(), errno);
+            }
+            return;
+        }
+
+        boost::shared_ptr<FastcgiConnection> connection(new FastcgiConnection(fd, endpoint, true));
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        if (-1 == epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event)) {
+            logger_->error("cannot watch connection on %s, errno = %i",
+                endpoint->toString().c_str(), errno);
+            continue;
+        }
+        connections_[fd] = connection;
+    }
+}
+
+void
+FastcgiReactor::readConnection(int fd) {
+    std::unordered_map<int, boost::shared_ptr<FastcgiConnection> >::iterator it = connections_.find(fd);
+    if (connections_.end() == it) {
+        return;
+    }
+    boost::shared_ptr<FastcgiConnection> connection = it->second;
+
+    FastcgiConnection::RequestList ready;
+    for (int i = 0; i < MAX_READS_PER_EVENT; ++i) {
+        ssize_t size = ::read(fd, &buffer_[0], buffer_.size());
+        if (size < 0 && EINTR == errno) {
+            continue;
+        }
+        if (size < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+            break;
+        }
+        bool consumed = false;
+        try {
+            consumed = size > 0 && connection->consume(&buffer_[0], size, ready);
+        }
+        catch (const std::exception &e) {
+            logger_->error("cannot process connection on %s: %s",
+                connection->endpoint()->toString().c_str(), e.what());
+        }
+        if (!consumed) {
+            closeConnection(fd);
+            break;
+        }
+        if (static_cast<std::size_t>(size) < buffer_.size()) {
+            break;
+        }
+    }
+
+    for (FastcgiConnection::RequestList::iterator i = ready.begin(); i != ready.end(); ++i) {
+        handler_(connection, *i);
+    }
+
+    // replies of the connection itself and of requests rejected right here
+    if (connections_.count(fd)) {
+        flushConnection(fd, connection.get());
+    }
+}
+
+void
+FastcgiReactor::writeConnection(int fd) {
+    std::unordered_map<int, boost::shared_ptr<FastcgiConnection> >::iterator it = connections_.find(fd);
+    if (connections_.end() != it) {
+        flushConnection(fd, it->second.get());
+    }
+}
+
+void
+FastcgiReactor::flushConnection(int fd, FastcgiConnection *connection) {
+    bool flushed = false;
+    try {
+        flushed = connection->flushControl(false);
+    }
+    catch (const std::exception &e) {
+        logger_->error("cannot write connection on %s: %s",
+            connection->endpoint()->toString().c_str(), e.what());
+        closeConnection(fd);
+        return;
+    }
+
+    // the connection is watched for writing only while its replies wait for the socket
+    if (flushed == (writing_.count(fd) == 0)) {
+        return;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    uint32_t events = EPOLLIN | EPOLLRDHUP;
+    if (!flushed) {
+        events |= EPOLLOUT;
+    }
+    event.events = events;
+    event.data.fd = fd;
+    epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event);
+    if (flushed) {
+        writing_.erase(fd);
+    }
+    else {
+        writing_.insert(fd);
+    }
+}
+
+void
+FastcgiReactor::closeConnection(int fd) {
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, NULL);
+    writing_.erase(fd);
+    std::unordered_map<int, boost::shared_ptr<FastcgiConnection> >::iterator i = connections_.find(fd);
+    if (i != connections_.end()) {
+        i->second->abortReading();
+    }
+    connections_.erase(fd);
+}
+
+void
+FastcgiReactor::closeExpiredConnections() {
+    last_expire_ = monotonicTime();
+    std::vector<int> expired;
+    for (std::unordered_map<int, boost::shared_ptr<FastcgiConnection> >::iterator i = connections_.begin();
+         i != connections_.end();
+         ++i) {
+        if (i->second->expired()) {
+            expired.push_back(i->first);
+        }
+    }
+    for (std::vector<int>::iterator i = expired.begin(); i != expired.end(); ++i) {
+        closeConnection(*i);
+    }
+}
+
+} // namespace fastcgi
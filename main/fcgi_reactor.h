@@ -0,0 +1,59 @@
+#pragma once
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <atomic>
+#include <ctime>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fastcgi {
+
+class Endpoint;
+class FastcgiConnection;
+class Logger;
+struct FastcgiRequestData;
+
+/**
+ * Epoll based IO loop. Every reactor listens on all endpoint sockets, owns the
+ * connections it has accepted and hands completely read requests to the handler.
+ */
+class FastcgiReactor : private boost::noncopyable {
+public:
+    typedef boost::function<void(boost::shared_ptr<FastcgiConnection>,
+        boost::shared_ptr<FastcgiRequestData>)> HandlerType;
+
+    FastcgiReactor(const std::vector<boost::shared_ptr<Endpoint> > &endpoints,
+        HandlerType handler, Logger *logger);
+    ~FastcgiReactor();
+
+    void run();
+    void stop();
+
+private:
+    void acceptConnections(Endpoint *endpoint);
+    void readConnection(int fd);
+    void writeConnection(int fd);
+    void flushConnection(int fd, FastcgiConnection *connection);
+    void closeConnection(int fd);
+    void closeExpiredConnections();
+
+private:
+    int epoll_;
+    int wakeup_;
+    std::atomic<bool> stopped_;
+    HandlerType handler_;
+    Logger *logger_;
+    std::map<int, Endpoint*> listeners_;
+    std::unordered_map<int, boost::shared_ptr<FastcgiConnection> > connections_;
+    std::unordered_set<int> writing_;
+    bool expiring_;
+    time_t last_expire_;
+    std::vector<char> buffer_;
+};
+
+} // namespace fastcgi
@@ -1,7 +1,7 @@
 #include "fcgi_request.h"
 
 #include "settings.h"
-#include "endpoint.h"
+#include "fcgi_connection.h"
 
 #include "fastcgi2/logger.h"
 #include "fastcgi2/request.h"
@@ -10,7 +10,9 @@
 
 #include <boost/lexical_cast.hpp>
 
+#include <algorithm>
 #include <cstring>
+#include <sstream>
 
 #ifdef HAVE_DMALLOC_H
 #include <dmalloc.h>
@@ -19,18 +21,41 @@
 namespace fastcgi {
 
 static const std::string DAEMON_STRING = "fastcgi-daemon";
+static const std::size_t OUTPUT_BUFFER_SIZE = 8192;
+static const std::size_t OUTPUT_PIECES = 64;
 
-FastcgiRequest::FastcgiRequest(boost::shared_ptr<Request> request, Endpoint *endpoint,
-        Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes) :
-    request_(request), logger_(logger), endpoint_(endpoint),
-    statistics_(statistics), logTimes_(logTimes), handler_(NULL)
+static const Range REQUEST_URI_RANGE = Range::fromChars("REQUEST_URI");
+static const Range REQUEST_ID_RANGE = Range::fromChars("REQUEST_ID");
+
+FastcgiRequest::FastcgiRequest(Request *request, Logger *logger, ResponseTimeStatistics *statistics,
+        const bool logTimes) :
+    request_(request), logger_(logger), statistics_(statistics), logTimes_(logTimes), handler_(NULL)
 {
-    if (0 != FCGX_InitRequest(&fcgiRequest_, endpoint_->socket(), 0)) {
-        throw std::runtime_error("can not init fastcgi request");
-    }
+    out_.reserve(OUTPUT_BUFFER_SIZE);
+    pieces_.reserve(OUTPUT_PIECES);
 }
 
 FastcgiRequest::~FastcgiRequest() {
+    if (connection_) {
+        finish();
+    }
+}
+
+void
+FastcgiRequest::reset(boost::shared_ptr<FastcgiConnection> connection, boost::shared_ptr<FastcgiRequestData> data) {
+    connection_ = connection;
+    data_ = data;
+    if (logTimes_ || statistics_) {
+        gettimeofday(&accept_time_, NULL);
+    }
+}
+
+void
+FastcgiRequest::finish() {
+    if (!connection_) {
+        return;
+    }
+
     boost::uint64_t microsec = 0;
     if (logTimes_ || statistics_) {
         gettimeofday(&finish_time_, NULL);
@@ -56,19 +81,65 @@ FastcgiRequest::~FastcgiRequest() {
         }
     }
 
-    FCGX_Finish_r(&fcgiRequest_);
+    try {
+        // the buffered output goes in the same call as the end of the request
+        struct iovec iov;
+        iov.iov_base = out_.empty() ? NULL : &out_[0];
+        iov.iov_len = out_.size();
+        connection_->finishRequest(data_->id, data_->keepConnection, &iov, 1);
+    }
+    catch (const std::exception &e) {
+        logger_->error("Exception caught while finishing request: %s", e.what());
+    }
+    // the rest of a body nobody has read is not kept
+    data_->abort();
+
+    cancel();
+}
+
+void
+FastcgiRequest::cancel() {
+    connection_.reset();
+    data_.reset();
+    env_.clear();
+    url_.clear();
+    request_id_.clear();
+    out_.clear();
+    handler_ = NULL;
+}
+
+void
+FastcgiRequest::parseParams() {
+    const std::vector<char> &params = data_->params;
+    if (params.empty()) {
+        return;
+    }
+
+    const char *pos = &params[0], *end = pos + params.size();
+    while (pos != end) {
+        Range name, value;
+        if (!FastcgiRecord::parseNameValue(pos, end, name, value)) {
+            throw std::runtime_error("malformed fastcgi params");
+        }
+        env_.push_back(std::make_pair(name, value));
+    }
+}
+
+static bool
+isParam(const Range &name, const Range &param) {
+    return name.size() == param.size() && 0 == strncasecmp(name.begin(), param.begin(), param.size());
 }
 
 void
-FastcgiRequest::attach() {
+FastcgiRequest::attach(bool streamBody) {
 
-    char **envp = fcgiRequest_.envp;
-    for (std::size_t i = 0; envp[i]; ++i) {
-        if (0 == strncasecmp(envp[i], "REQUEST_URI=", sizeof("REQUEST_URI=") - 1)) {
-            url_.assign(envp[i] + sizeof("REQUEST_URI=") - 1);
+    parseParams();
+    for (std::vector<std::pair<Range, Range> >::const_iterator i = env_.begin(); i != env_.end(); ++i) {
+        if (isParam(i->first, REQUEST_URI_RANGE)) {
+            url_ = i->second.toString();
         }
-        if (0 == strncasecmp(envp[i], "REQUEST_ID=", sizeof("REQUEST_ID=") - 1)) {
-            request_id_.assign(envp[i] + sizeof("REQUEST_ID=") - 1);
+        else if (isParam(i->first, REQUEST_ID_RANGE)) {
+            request_id_ = i->second.toString();
         }
     }
 
@@ -77,21 +148,12 @@ FastcgiRequest::attach() {
         logger_req_id->setRequestId(request_id_);
     }
 
-    request_->attach(this, fcgiRequest_.envp);
-}
-
-int
-FastcgiRequest::accept() {
-    int status = FCGX_Accept_r(&fcgiRequest_);
-    if (status >= 0 && (logTimes_|| statistics_)) {
-        gettimeofday(&accept_time_, NULL);
-    }
-    return status;
+    request_->attach(this, env_, streamBody);
 }
 
 int
 FastcgiRequest::read(char *buf, int size) {
-    return FCGX_GetStr(buf, size, fcgiRequest_.in);
+    return data_->readBody(buf, size);
 }
 
 static void
@@ -127,32 +189,96 @@ generateRequestInfo(const Request *request, std::stringstream &str) {
     str << ". Args: " << result;
 }
 
+void
+FastcgiRequest::throwWriteError(const char *action, const std::string &error) {
+    std::stringstream str;
+    str << "Cannot " << action << " data to fastcgi socket: " << error << ". ";
+    generateRequestInfo(request_, str);
+    throw std::runtime_error(str.str());
+}
+
+void
+FastcgiRequest::flushOutput() {
+    if (out_.empty()) {
+        return;
+    }
+    try {
+        connection_->write(FastcgiRecord::STDOUT, data_->id, &out_[0], out_.size());
+    }
+    catch (const std::exception &e) {
+        out_.clear();
+        throwWriteError("write", e.what());
+    }
+    out_.clear();
+}
+
+// sends the buffered output followed by the pieces in one call, the pieces
+// are not copied
+void
+FastcgiRequest::sendOutput(const struct iovec *iov, int count) {
+    pieces_.clear();
+    if (!out_.empty()) {
+        struct iovec buffered;
+        buffered.iov_base = &out_[0];
+        buffered.iov_len = out_.size();
+        pieces_.push_back(buffered);
+    }
+    pieces_.insert(pieces_.end(), iov, iov + count);
+    try {
+        connection_->write(FastcgiRecord::STDOUT, data_->id, &pieces_[0], pieces_.size());
+    }
+    catch (const std::exception &e) {
+        out_.clear();
+        throwWriteError("write", e.what());
+    }
+    out_.clear();
+}
+
 int
 FastcgiRequest::write(const char *buf, int size) {
-    int num = FCGX_PutStr(buf, size, fcgiRequest_.out);
-    if (-1 == num) {
-        std::stringstream str;
-        int error = FCGX_GetError(fcgiRequest_.out);
-        if (error > 0) {
-            char buffer[256];
-            str << "Cannot write data to fastcgi socket: " <<
-                strerror_r(error, buffer, sizeof(buffer)) << ". ";
-        }
-        else {
-            str << "FastCGI error. ";
-        }
-        generateRequestInfo(request_.get(), str);
-        throw std::runtime_error(str.str());
+    if (out_.size() + size > OUTPUT_BUFFER_SIZE) {
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(buf);
+        iov.iov_len = size;
+        sendOutput(&iov, 1);
+    }
+    else {
+        out_.insert(out_.end(), buf, buf + size);
+    }
+    return size;
+}
+
+void
+FastcgiRequest::write(const struct iovec *iov, int count) {
+    std::size_t size = 0;
+    for (int i = 0; i < count; ++i) {
+        size += iov[i].iov_len;
+    }
+    if (out_.size() + size > OUTPUT_BUFFER_SIZE) {
+        sendOutput(iov, count);
+        return;
+    }
+    for (int i = 0; i < count; ++i) {
+        const char *data = static_cast<const char*>(iov[i].iov_base);
+        out_.insert(out_.end(), data, data + iov[i].iov_len);
     }
-    return num;
 }
 
 void
 FastcgiRequest::write(std::streambuf *buf) {
-    std::vector<char> outv(4096);
-    fcgi_streambuf outbuf(fcgiRequest_.out, &outv[0], outv.size());
-    std::ostream os(&outbuf);
-    os << buf;
+    // the stream is read into the output buffer directly
+    while (true) {
+        if (out_.size() == OUTPUT_BUFFER_SIZE) {
+            flushOutput();
+        }
+        const std::size_t used = out_.size();
+        out_.resize(OUTPUT_BUFFER_SIZE);
+        const std::streamsize size = buf->sgetn(&out_[used], OUTPUT_BUFFER_SIZE - used);
+        out_.resize(used + std::max(size, static_cast<std::streamsize>(0)));
+        if (size <= 0) {
+            break;
+        }
+    }
 }
 
 void
@@ -162,21 +288,7 @@ FastcgiRequest::setHandlerDesc(const HandlerSet::HandlerDescription *handler) {
 
 void
 FastcgiRequest::flush() {
-    int num = FCGX_FFlush(fcgiRequest_.out);
-    if (-1 == num) {
-        std::stringstream str;
-        int error = FCGX_GetError(fcgiRequest_.out);
-        if (error > 0) {
-            char buffer[256];
-            str << "Cannot flush data to fastcgi socket: " <<
-                strerror_r(error, buffer, sizeof(buffer)) << ". ";
-        }
-        else {
-            str << "FastCGI error. ";
-        }
-        generateRequestInfo(request_.get(), str);
-        throw std::runtime_error(str.str());
-    }
+    flushOutput();
 }
 
 } // namespace fastcgi
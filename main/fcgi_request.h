@@ -2,45 +2,60 @@
 
 #include <sys/time.h>
 
-#include <fcgiapp.h>
-#include <fcgio.h>
-
 #include <memory>
+#include <utility>
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
 
 #include "fastcgi2/request_io_stream.h"
 #include "details/handlerset.h"
+#include "details/range.h"
 
 namespace fastcgi {
 
-class Endpoint;
+class FastcgiConnection;
 class Logger;
 class Request;
 class ResponseTimeStatistics;
+struct FastcgiRequestData;
 
 class FastcgiRequest : public RequestIOStream {
 public:
-    FastcgiRequest(boost::shared_ptr<Request> request, Endpoint *endpoint,
-        Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes);
+    FastcgiRequest(Request *request, Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes);
     virtual ~FastcgiRequest();
-    void attach();
-    int accept();
+
+    // the stream serves one request between reset() and finish() and may be reused after it
+    void reset(boost::shared_ptr<FastcgiConnection> connection, boost::shared_ptr<FastcgiRequestData> data);
+    void finish();
+
+    void attach(bool streamBody = false);
 
     int read(char *buf, int size);
     int write(const char *buf, int size);
     void write(std::streambuf *buf);
+    void write(const struct iovec *iov, int count);
 
     void setHandlerDesc(const HandlerSet::HandlerDescription *handler);
     void flush();
 private:
-    boost::shared_ptr<Request> request_;
+    void cancel();
+    void parseParams();
+    void flushOutput();
+    void sendOutput(const struct iovec *iov, int count);
+    void throwWriteError(const char *action, const std::string &error);
+
+private:
+    Request *request_;
     Logger *logger_;
     std::string url_;
     std::string request_id_;
-    Endpoint *endpoint_;
-    FCGX_Request fcgiRequest_;
+    boost::shared_ptr<FastcgiConnection> connection_;
+    boost::shared_ptr<FastcgiRequestData> data_;
+    std::vector<std::pair<Range, Range> > env_;
+    std::vector<char> out_;
+    // the list sendOutput gathers, kept to be reused
+    std::vector<struct iovec> pieces_;
     ResponseTimeStatistics *statistics_;
     const bool logTimes_;
     timeval accept_time_, finish_time_;
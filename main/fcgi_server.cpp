@@ -2,6 +2,7 @@
 
 #include <cerrno>
 #include <fstream>
+#include <iostream>
 #include <sstream>
 #include <stdexcept>
 #include <algorithm>
@@ -11,6 +12,7 @@
 #include <boost/function.hpp>
 #include <boost/checked_delete.hpp>
 #include <boost/current_function.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -21,9 +23,13 @@
 #include <sys/time.h>
 
 #include "endpoint.h"
+#include "fcgi_connection.h"
+#include "fcgi_reactor.h"
 #include "fcgi_request.h"
 #include "fcgi_server.h"
+#include "request_pool.h"
 
+#include "fastcgi2/arena.h"
 #include "fastcgi2/util.h"
 #include "fastcgi2/config.h"
 #include "fastcgi2/except.h"
@@ -34,11 +40,13 @@
 #include "fastcgi2/component.h"
 #include "fastcgi2/request_io_stream.h"
 
+#include "details/chunked_buffer.h"
 #include "details/componentset.h"
 #include "details/globals.h"
 #include "details/handler_context.h"
 #include "details/handlerset.h"
 #include "details/loader.h"
+#include "details/range.h"
 #include "details/request_cache.h"
 #include "details/request_thread_pool.h"
 #include "details/thread_pool.h"
@@ -50,9 +58,16 @@
 namespace fastcgi
 {
 
+static const int DEFAULT_IDLE_TIMEOUT = 60;
+static const std::size_t DEFAULT_REQUEST_POOL_SIZE = 64;
+
+static const Range CONTENT_LENGTH_RANGE = Range::fromChars("HTTP_CONTENT_LENGTH");
+
 FCGIServer::FCGIServer(boost::shared_ptr<Globals> globals) :
 	globals_(globals), stopper_(new ServerStopper()), active_thread_holder_(new char(0)),
-	monitorSocket_(-1), request_cache_(NULL), time_statistics_(NULL), status_(NOT_INITED)
+	ioThreads_(0), monitorSocket_(-1), request_cache_(NULL), time_statistics_(NULL), status_(NOT_INITED),
+	logTimes_(false), streamBodies_(false), rematchHandlers_(false), arenaSize_(Arena::DEFAULT_BLOCK_SIZE), requestPoolSize_(DEFAULT_REQUEST_POOL_SIZE),
+	bodyFileThreshold_(0)
 {}
 
 FCGIServer::~FCGIServer() {
@@ -89,6 +104,18 @@ FCGIServer::start() {
 	status_ = LOADING;
 
 	logTimes_ = globals_->config()->asInt("/fastcgi/daemon/log-times", 0);
+	arenaSize_ = std::max(globals_->config()->asInt("/fastcgi/daemon/request-arena-size", 0), 0);
+	if (0 == arenaSize_) {
+		arenaSize_ = Arena::DEFAULT_BLOCK_SIZE;
+	}
+	requestPoolSize_ = std::max(globals_->config()->asInt("/fastcgi/daemon/request-pool-size", 0), 0);
+	if (0 == requestPoolSize_) {
+		requestPoolSize_ = DEFAULT_REQUEST_POOL_SIZE;
+	}
+	bodyFileThreshold_ = std::max(globals_->config()->asInt("/fastcgi/daemon/request-body-file-size", 0), 0);
+	bodyFileDir_ = globals_->config()->asString("/fastcgi/daemon/request-body-file-dir", "/tmp");
+	streamBodies_ = globals_->handlers()->hasStreamBodies();
+	rematchHandlers_ = NULL != globals_->handlers()->findParamHandler();
 
 	initMonitorThread();
 
@@ -152,7 +179,11 @@ FCGIServer::stopInternal() {
 
 	stopper_->stopped(true);
 
-	FCGX_ShutdownPending();
+	for (std::vector<boost::shared_ptr<FastcgiReactor> >::iterator i = reactors_.begin();
+		 i != reactors_.end();
+		 ++i) {
+		(*i)->stop();
+	}
 	globals_->stopThreadPools();
 }
 
@@ -218,6 +249,23 @@ FCGIServer::initTimeStatistics() {
 
 void
 FCGIServer::createWorkThreads() {
+	if (ioThreads_) {
+		// reactors serve all endpoints, so they may run on any of their cpus
+		CpuSet cpus;
+		for (std::vector<boost::shared_ptr<Endpoint> >::iterator i = endpoints_.begin(); i != endpoints_.end(); ++i) {
+			cpus.merge((*i)->cpus());
+		}
+		for (unsigned short t = 0; t < ioThreads_; ++t) {
+			// every reactor runs in its own thread and takes requests from its own pool
+			FastcgiReactor::HandlerType handler =
+				boost::bind(&FCGIServer::handleConnectionRequest, this, createRequestPool(), _1, _2);
+			boost::shared_ptr<FastcgiReactor> reactor(new FastcgiReactor(endpoints_, handler, logger()));
+			reactors_.push_back(reactor);
+			globalPool_.create_thread(boost::bind(&FCGIServer::runReactor, this, reactor.get(), cpus));
+		}
+		return;
+	}
+
 	for (std::vector<boost::shared_ptr<Endpoint> >::iterator i = endpoints_.begin();
 		 i != endpoints_.end();
 		 ++i) {
@@ -228,19 +276,29 @@ FCGIServer::createWorkThreads() {
 	}
 }
 
+void
+FCGIServer::runReactor(FastcgiReactor *reactor, CpuSet cpus) {
+	bindThread(cpus);
+	reactor->run();
+}
+
 void
 FCGIServer::initFastCGISubsystem() {
-	if (0 != FCGX_Init()) {
-		throw std::runtime_error("Cannot init fastcgi library");
-	}
+	ioThreads_ = globals_->config()->asInt("/fastcgi/daemon/io-threads", 0);
 
 	std::vector<std::string> v;
 	globals_->config()->subKeys("/fastcgi/daemon/endpoint", v);
 	for (std::vector<std::string>::iterator i = v.begin(), end = v.end(); i != end; ++i) {
+		const std::string threads = ioThreads_ ?
+			globals_->config()->asString(*i + "/threads", "0") :
+			globals_->config()->asString(*i + "/threads");
 		boost::shared_ptr<Endpoint> endpoint(new Endpoint(
 			globals_->config()->asString(*i + "/socket", ""),
 			globals_->config()->asString(*i + "/port", ""),
-			boost::lexical_cast<unsigned>(globals_->config()->asString(*i + "/threads"))));
+			boost::lexical_cast<unsigned>(threads),
+			globals_->config()->asInt(*i + "/idle-timeout", DEFAULT_IDLE_TIMEOUT),
+			globals_->config()->asInt(*i + "/max-requests", 0),
+			endpointCpus(*i)));
 		const int backlog = globals_->config()->asInt(*i + "/backlog", SOMAXCONN);
 		endpoint->openSocket(backlog);
 		endpoints_.push_back(endpoint);
@@ -251,53 +309,69 @@ FCGIServer::initFastCGISubsystem() {
 	}
 }
 
+CpuSet
+FCGIServer::endpointCpus(const std::string &key) const {
+	CpuSet cpus = CpuSet::parse(globals_->config()->asString(key + "/cpus", ""));
+	const std::string poolName = globals_->config()->asString(key + "/pool", "");
+	if (!cpus.empty() || poolName.empty()) {
+		return cpus;
+	}
+
+	// the endpoint is paired with a pool and runs on its cpus
+	const Globals::ThreadPoolMap &pools = globals_->pools();
+	Globals::ThreadPoolMap::const_iterator pool = pools.find(poolName);
+	if (pools.end() == pool) {
+		throw std::runtime_error("cannot find pool " + poolName + " paired with endpoint");
+	}
+	return pool->second->cpus();
+}
+
+void
+FCGIServer::bindThread(const CpuSet &cpus) {
+	if (cpus.empty()) {
+		return;
+	}
+	try {
+		cpus.apply();
+	}
+	catch (const std::exception &e) {
+		globals_->logger()->error("%s", e.what());
+	}
+}
+
 void
 FCGIServer::handle(Endpoint *endpoint) {
 	boost::shared_ptr<ServerStopper> stopper = stopper_;
 	Logger* logger = globals_->logger();
+	boost::shared_ptr<RequestPool> pool = createRequestPool();
+	bindThread(endpoint->cpus());
 	while (true) {
 		try {
 			if (stopper->stopped()) {
 				return;
 			}
-			boost::shared_ptr<ThreadHolder> holder = active_thread_holder_;
-
-			Endpoint::ScopedBusyCounter busyCounter(*endpoint);
-			RequestTask task;
-			task.request = boost::shared_ptr<Request>(new Request(logger, request_cache_));
-			task.request_stream = boost::shared_ptr<RequestIOStream>(
-				new FastcgiRequest(task.request, endpoint, logger, time_statistics_, logTimes_));
-
-			FastcgiRequest *request = dynamic_cast<FastcgiRequest*>(task.request_stream.get());
-
-			busyCounter.decrement();
-			holder.reset();
-			int status = request->accept();
-			if (stopper->stopped()) {
-				return;
-			}
-			holder = active_thread_holder_;
-			if (status < 0) {
-				throw std::runtime_error("failed to accept fastcgi request: " +
-					boost::lexical_cast<std::string>(status));
-			}
-			busyCounter.increment();
-
-			try {
-				request->attach();
-			}
-			catch (const std::exception &e) {
-				logger->error("caught exception while attach request: %s", e.what());
-				task.request->sendError(400);
-				continue;
-			}
-
+			const int fd = endpoint->accept();
+			boost::shared_ptr<FastcgiConnection> connection(new FastcgiConnection(fd, endpoint, false));
 			try {
-				handleRequest(task);
+				while (!stopper->stopped()) {
+					boost::shared_ptr<FastcgiRequestData> data = connection->receive();
+					if (!data || stopper->stopped()) {
+						break;
+					}
+					handleConnectionRequest(pool, connection, data);
+					// the body of a streamed request is still to be read
+					if (!data->keepConnection && data->bodyComplete()) {
+						break;
+					}
+				}
+				// requests rejected by this thread have their replies queued
+				connection->flushControl(true);
 			}
-			catch (const std::exception &e) {
-				task.request->sendError(500);
+			catch (...) {
+				connection->abortReading();
+				throw;
 			}
+			connection->abortReading();
 		}
 		catch (const std::exception &e) {
 			logger->error("caught exception while handling request: %s", e.what());
@@ -308,13 +382,121 @@ FCGIServer::handle(Endpoint *endpoint) {
 	}
 }
 
+boost::shared_ptr<RequestPool>
+FCGIServer::createRequestPool() const {
+	return boost::shared_ptr<RequestPool>(new RequestPool(requestPoolSize_, globals_->logger(),
+		request_cache_, arenaSize_, bodyFileThreshold_, bodyFileDir_, time_statistics_, logTimes_));
+}
+
+// the body size the params announce, looked up before the request is parsed
+static boost::uint64_t
+announcedBodySize(const FastcgiRequestData &data) {
+	const char *pos = data.params.empty() ? NULL : &data.params[0];
+	const char *end = pos + data.params.size();
+	while (pos != end) {
+		Range name, value;
+		if (!FastcgiRecord::parseNameValue(pos, end, name, value)) {
+			break;
+		}
+		if (CONTENT_LENGTH_RANGE == name) {
+			try {
+				return boost::lexical_cast<boost::uint64_t>(value.begin(), value.size());
+			}
+			catch (const boost::bad_lexical_cast&) {
+				break;
+			}
+		}
+	}
+	return 0;
+}
+
+void
+FCGIServer::handleConnectionRequest(boost::shared_ptr<RequestPool> pool,
+	boost::shared_ptr<FastcgiConnection> connection, boost::shared_ptr<FastcgiRequestData> data) {
+	Logger* logger = globals_->logger();
+	try {
+		if (stopper_->stopped()) {
+			return;
+		}
+		boost::shared_ptr<ThreadHolder> holder = active_thread_holder_;
+
+		// a request comes once its params are read and once more with its body,
+		// it is taken at once when a handler may stream the body or the body
+		// is large, the pool thread then reads it while it arrives
+		if (!data->bodyComplete()) {
+			if (!streamBodies_ && announcedBodySize(*data) <= ChunkedBuffer::BLOCK_SIZE) {
+				return;
+			}
+			if (!data->stream()) {
+				return;
+			}
+		}
+
+		RequestTask task;
+		FastcgiRequest *request = pool->acquire(task, connection, data);
+		dispatch(task, request);
+	}
+	catch (const std::exception &e) {
+		logger->error("caught exception while handling request: %s", e.what());
+	}
+	catch (...) {
+		logger->error("caught unknown exception while handling request");
+	}
+}
+
+void
+FCGIServer::dispatch(RequestTask task, FastcgiRequest *request) {
+	// the params are enough to pick the handler, the body is read by its pool thread
+	try {
+		request->attach(true);
+	}
+	catch (const std::exception &e) {
+		logger()->error("caught exception while attach request: %s", e.what());
+		task.request->sendError(400);
+		return;
+	}
+
+	try {
+		handleRequest(task);
+	}
+	catch (const std::exception &e) {
+		task.request->sendError(500);
+	}
+}
+
 void
 FCGIServer::handleRequest(RequestTask task) {
 	logger()->debug("handling request %s", task.request->getScriptName().c_str());
 	FastcgiRequest *request = dynamic_cast<FastcgiRequest*>(task.request_stream.get());
 	const HandlerSet::HandlerDescription* handler = getHandler(task);
+	if (NULL == handler && rematchHandlers_ && task.request->isBodyStreamed()) {
+		// form fields may still match a param filter, so the body is read in
+		// the pool of such a handler and the request is matched again after it
+		handler = globals()->handlers()->findParamHandler();
+		task.streamBody = false;
+	}
+	else {
+		task.streamBody = handler && handler->streamBody;
+	}
 	request->setHandlerDesc(handler);
+	if (rematchHandlers_ && !task.streamBody) {
+		task.rematch = boost::bind(&FCGIServer::rematch, this, _1);
+	}
+	handleRequestInternal(handler, std::move(task));
+}
+
+bool
+FCGIServer::rematch(RequestTask &task) {
+	// param filters have seen the query string only when the handler was picked
+	const HandlerSet::HandlerDescription* handler = getHandler(task);
+	if (handler && &handler->handlers == task.handlers) {
+		return false;
+	}
+	FastcgiRequest *request = dynamic_cast<FastcgiRequest*>(task.request_stream.get());
+	request->setHandlerDesc(handler);
+	task.rematch.clear();
 	handleRequestInternal(handler, task);
+	return true;
 }
 
 void
@@ -424,6 +606,9 @@ FCGIServer::getServerInfo() const {
 				<< " busy=\"" << (*i)->getBusyCounter() << "\""
 				<< "/>\n";
 		}
+		if (!reactors_.empty()) {
+			s << "<reactor threads=\"" << reactors_.size() << "\"/>\n";
+		}
 		s << "</endpoint_pools>\n";
 
 		const Globals::ThreadPoolMap& pools = globals_->pools();
@@ -434,6 +619,7 @@ FCGIServer::getServerInfo() const {
 			uint64_t badTasks = info.badTasksCounter;
 			s << "<pool name=\"" << i->first << "\""
 				<< " threads=\"" << info.threadsNumber << "\""
+				<< " max_threads=\"" << info.maxThreadsNumber << "\""
 				<< " busy=\"" << info.busyThreadsCounter << "\""
 				<< " queue=\"" << info.queueLength << "\""
 				<< " current_queue=\"" << info.currentQueue << "\""
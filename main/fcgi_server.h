@@ -1,5 +1,6 @@
 #pragma once
 
+#include "details/cpu_set.h"
 #include "details/server.h"
 
 #include <boost/thread.hpp>
@@ -17,9 +18,14 @@ class Request;
 class Logger;
 class Loader;
 class Endpoint;
+class FastcgiConnection;
+class FastcgiReactor;
+class FastcgiRequest;
 class ComponentSet;
 class HandlerSet;
+class RequestPool;
 class RequestsThreadPool;
+struct FastcgiRequestData;
 
 class ServerStopper {
 public:
@@ -81,6 +87,14 @@ private:
 	virtual Logger* logger() const;
 	virtual void handleRequest(RequestTask task);
 	void handle(Endpoint *endpoint);
+	void runReactor(FastcgiReactor *reactor, CpuSet cpus);
+	void bindThread(const CpuSet &cpus);
+	CpuSet endpointCpus(const std::string &key) const;
+	boost::shared_ptr<RequestPool> createRequestPool() const;
+	void handleConnectionRequest(boost::shared_ptr<RequestPool> pool,
+		boost::shared_ptr<FastcgiConnection> connection, boost::shared_ptr<FastcgiRequestData> data);
+	void dispatch(RequestTask task, FastcgiRequest *request);
+	bool rematch(RequestTask &task);
 	void monitor();
 
 	std::string getServerInfo() const;
@@ -106,6 +120,8 @@ private:
 	boost::shared_ptr<ThreadHolder> active_thread_holder_;
 
 	std::vector<boost::shared_ptr<Endpoint> > endpoints_;
+	std::vector<boost::shared_ptr<FastcgiReactor> > reactors_;
+	unsigned short ioThreads_;
 	int monitorSocket_;
 
 	RequestCache *request_cache_;
@@ -119,6 +135,12 @@ private:
 	int stopPipes_[2];
 
 	bool logTimes_;
+	bool streamBodies_;
+	bool rematchHandlers_;
+	std::size_t arenaSize_;
+	std::size_t requestPoolSize_;
+	boost::uint64_t bodyFileThreshold_;
+	std::string bodyFileDir_;
 	boost::thread_group globalPool_;
 };
 
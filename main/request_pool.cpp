@@ -0,0 +1,134 @@
+#include "settings.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+#include "fcgi_request.h"
+#include "request_pool.h"
+
+#include "fastcgi2/logger.h"
+#include "fastcgi2/request.h"
+
+#include "details/request_thread_pool.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+struct RequestPool::Item {
+    Item(Logger *logger, RequestCache *cache, std::size_t arenaSize, ResponseTimeStatistics *statistics,
+        bool logTimes) :
+        request(logger, cache, arenaSize), stream(&request, logger, statistics, logTimes)
+    {}
+
+    Request request;
+    FastcgiRequest stream;
+
+    // set while the item is out of the pool
+    boost::shared_ptr<RequestPool> pool;
+
+    // room for the shared_ptr control block of the item
+    std::aligned_storage<64, alignof(std::max_align_t)>::type control;
+};
+
+class RequestPool::Releaser {
+public:
+    void operator () (Item *item) const {
+        try {
+            item->stream.finish();
+            item->request.recycle();
+        }
+        catch (const std::exception &e) {
+            item->pool->logger_->error("caught exception while releasing request: %s", e.what());
+        }
+    }
+};
+
+/**
+ * Places the control block into the item. The control block is deallocated
+ * after the releaser has run and after the block itself is destroyed, so this
+ * is the last moment the item is touched and it goes back to the pool here.
+ */
+template<typename T>
+class RequestPool::ItemAllocator {
+public:
+    typedef T value_type;
+
+    explicit ItemAllocator(Item *item) : item_(item) {
+    }
+
+    template<typename U> ItemAllocator(const ItemAllocator<U> &other) : item_(other.item()) {
+    }
+
+    T* allocate(std::size_t n) {
+        if (n * sizeof(T) > sizeof(item_->control)) {
+            throw std::bad_alloc();
+        }
+        return reinterpret_cast<T*>(&item_->control);
+    }
+
+    void deallocate(T*, std::size_t) {
+        boost::shared_ptr<RequestPool> pool;
+        pool.swap(item_->pool);
+        pool->release(item_);
+    }
+
+    Item* item() const {
+        return item_;
+    }
+
+    friend bool operator == (const ItemAllocator &lhs, const ItemAllocator &rhs) {
+        return lhs.item_ == rhs.item_;
+    }
+
+    friend bool operator != (const ItemAllocator &lhs, const ItemAllocator &rhs) {
+        return lhs.item_ != rhs.item_;
+    }
+
+private:
+    Item *item_;
+};
+
+RequestPool::RequestPool(std::size_t size, Logger *logger, RequestCache *cache, std::size_t arenaSize,
+    boost::uint64_t bodyFileThreshold, const std::string &bodyFileDir,
+    ResponseTimeStatistics *statistics, bool logTimes) :
+    logger_(logger), cache_(cache), arenaSize_(arenaSize), bodyFileThreshold_(bodyFileThreshold),
+    bodyFileDir_(bodyFileDir), statistics_(statistics), logTimes_(logTimes), items_(size)
+{}
+
+RequestPool::~RequestPool() {
+    Item *item = NULL;
+    while (items_.pop(item)) {
+        delete item;
+    }
+}
+
+FastcgiRequest*
+RequestPool::acquire(RequestTask &task, boost::shared_ptr<FastcgiConnection> connection,
+    boost::shared_ptr<FastcgiRequestData> data) {
+
+    Item *item = NULL;
+    if (!items_.pop(item)) {
+        item = new Item(logger_, cache_, arenaSize_, statistics_, logTimes_);
+        item->request.setBodyFileThreshold(bodyFileThreshold_, bodyFileDir_);
+    }
+    item->pool = shared_from_this();
+    item->stream.reset(connection, data);
+
+    boost::shared_ptr<Item> holder(item, Releaser(), ItemAllocator<Item>(item));
+    task.request = boost::shared_ptr<Request>(holder, &item->request);
+    task.request_stream = boost::shared_ptr<RequestIOStream>(holder, &item->stream);
+    return &item->stream;
+}
+
+void
+RequestPool::release(Item *item) {
+    if (!items_.push(std::move(item))) {
+        delete item;
+    }
+}
+
+} // namespace fastcgi
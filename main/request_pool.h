@@ -0,0 +1,61 @@
+#pragma once
+
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <cstddef>
+#include <string>
+
+#include "details/mpmc_ring.h"
+
+namespace fastcgi {
+
+class FastcgiConnection;
+class FastcgiRequest;
+class Logger;
+class Request;
+class RequestCache;
+class ResponseTimeStatistics;
+struct FastcgiRequestData;
+struct RequestTask;
+
+/**
+ * Request objects of one accepting thread. A request goes back to the pool of
+ * the thread that took it when its last shared_ptr is released, whatever thread
+ * that happens in, and is reset there for the next one. The shared_ptr control
+ * block lives in the pooled object too, so once the pool has warmed up taking
+ * and releasing requests does not allocate. At most size idle requests are kept,
+ * extra ones are deleted.
+ */
+class RequestPool : public boost::enable_shared_from_this<RequestPool>, private boost::noncopyable {
+public:
+    RequestPool(std::size_t size, Logger *logger, RequestCache *cache, std::size_t arenaSize,
+        boost::uint64_t bodyFileThreshold, const std::string &bodyFileDir,
+        ResponseTimeStatistics *statistics, bool logTimes);
+    ~RequestPool();
+
+    // fills request and request_stream of the task
+    FastcgiRequest* acquire(RequestTask &task, boost::shared_ptr<FastcgiConnection> connection,
+        boost::shared_ptr<FastcgiRequestData> data);
+
+private:
+    struct Item;
+    class Releaser;
+    template<typename T> class ItemAllocator;
+
+    void release(Item *item);
+
+private:
+    Logger *logger_;
+    RequestCache *cache_;
+    std::size_t arenaSize_;
+    boost::uint64_t bodyFileThreshold_;
+    std::string bodyFileDir_;
+    ResponseTimeStatistics *statistics_;
+    bool logTimes_;
+    MpmcRing<Item*> items_;
+};
+
+} // namespace fastcgi
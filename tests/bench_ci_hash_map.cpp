@@ -0,0 +1,136 @@
+#include "settings.h"
+
+#include <ext/hash_map>
+
+#include <boost/cstdint.hpp>
+
+#include <strings.h>
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "details/ci_hash_map.h"
+#include "details/functors.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+// Compares insert and lookup throughput of the header map with the maps
+// request headers were kept in before: __gnu_cxx::hash_map with the additive
+// case insensitive hash and std::map with a case insensitive comparison.
+
+namespace {
+
+struct StringCIHash {
+	std::size_t operator () (const std::string &str) const {
+		boost::uint32_t value = 0;
+		for (std::string::const_iterator i = str.begin(), end = str.end(); i != end; ++i) {
+			value += 5 * tolower(*i);
+		}
+		return value;
+	}
+};
+
+struct StringCIEqual {
+	bool operator () (const std::string &str, const std::string &target) const {
+		return str.size() == target.size() && 0 == strncasecmp(str.c_str(), target.c_str(), str.size());
+	}
+};
+
+struct StringCILess {
+	bool operator () (const std::string &str, const std::string &target) const {
+		return std::lexicographical_compare(str.begin(), str.end(), target.begin(), target.end(),
+			fastcgi::CharCILess());
+	}
+};
+
+typedef __gnu_cxx::hash_map<std::string, std::string, StringCIHash, StringCIEqual> LegacyHashMap;
+typedef std::map<std::string, std::string, StringCILess> TreeMap;
+typedef fastcgi::CIHashMap<std::string> SwissMap;
+
+const char* const COMMON_NAMES[] = {
+	"Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding", "Referer", "Cookie",
+	"Connection", "Cache-Control", "Content-Type", "Content-Length", "X-Forwarded-For",
+	"X-Real-IP", "X-Request-Id", "If-Modified-Since", "If-None-Match", "Authorization", "Origin"
+};
+
+volatile std::size_t sink;
+
+template<typename Map> double
+bench(const std::vector<std::string> &names, const std::vector<std::string> &queries, int rounds,
+	double &lookupRate) {
+
+	typedef std::chrono::steady_clock Clock;
+	std::chrono::duration<double> insertTime(0), lookupTime(0);
+
+	for (int round = 0; round < rounds; ++round) {
+		Map map;
+		Clock::time_point start = Clock::now();
+		for (std::vector<std::string>::const_iterator i = names.begin(), end = names.end(); i != end; ++i) {
+			map[*i] = *i;
+		}
+		Clock::time_point inserted = Clock::now();
+		std::size_t found = 0;
+		for (std::vector<std::string>::const_iterator i = queries.begin(), end = queries.end(); i != end; ++i) {
+			found += map.find(*i) != map.end();
+		}
+		Clock::time_point looked = Clock::now();
+		sink = found;
+		insertTime += inserted - start;
+		lookupTime += looked - inserted;
+	}
+	lookupRate = rounds * queries.size() / lookupTime.count() / 1e6;
+	return rounds * names.size() / insertTime.count() / 1e6;
+}
+
+void
+run(const char *title, const std::vector<std::string> &names, int rounds) {
+	std::vector<std::string> queries;
+	for (int repeat = 0; repeat < 10; ++repeat) {
+		for (std::vector<std::string>::const_iterator i = names.begin(), end = names.end(); i != end; ++i) {
+			std::string query = *i;
+			// look up in another case half of the time and miss one time in four
+			if (repeat % 2) {
+				for (std::string::iterator c = query.begin(); c != query.end(); ++c) {
+					*c = toupper(*c);
+				}
+			}
+			if (3 == repeat % 4) {
+				query += "-miss";
+			}
+			queries.push_back(query);
+		}
+	}
+
+	double legacyLookup, treeLookup, swissLookup;
+	double legacyInsert = bench<LegacyHashMap>(names, queries, rounds, legacyLookup);
+	double treeInsert = bench<TreeMap>(names, queries, rounds, treeLookup);
+	double swissInsert = bench<SwissMap>(names, queries, rounds, swissLookup);
+
+	printf("%s, %zu names (millions of operations per second)\n", title, names.size());
+	printf("  %-24s insert %8.2f  lookup %8.2f\n", "__gnu_cxx::hash_map", legacyInsert, legacyLookup);
+	printf("  %-24s insert %8.2f  lookup %8.2f\n", "std::map", treeInsert, treeLookup);
+	printf("  %-24s insert %8.2f  lookup %8.2f\n", "CIHashMap", swissInsert, swissLookup);
+}
+
+} // namespace
+
+int
+main() {
+	std::vector<std::string> common(COMMON_NAMES, COMMON_NAMES + sizeof(COMMON_NAMES) / sizeof(COMMON_NAMES[0]));
+	run("common headers", common, 200000);
+
+	// names differing in the order of their letters have the same additive hash
+	std::vector<std::string> many;
+	for (int i = 0; i < 200; ++i) {
+		std::string name = "X-Custom-" + std::to_string(i);
+		many.push_back(name);
+		many.push_back("X-Custom-" + std::string(name.rbegin(), name.rbegin() + name.size() - 9));
+	}
+	run("custom headers", many, 5000);
+	return 0;
+}
@@ -0,0 +1,142 @@
+#include "settings.h"
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fastcgi2/data_buffer.h"
+#include "fastcgi2/logger.h"
+#include "fastcgi2/request.h"
+#include "fastcgi2/request_io_stream.h"
+
+#include "details/data_buffer_impl.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+// Parses a multipart body of many small fields and converts every field of it
+// to a string, the way parts are turned into arguments. The conversion is timed
+// with DataBuffer::toString and with the loop it ran before segment iterators
+// stopped copying the storage of the buffer.
+
+namespace {
+
+using namespace fastcgi;
+
+typedef std::chrono::steady_clock Clock;
+
+const char BOUNDARY[] = "----------------------------bench4f2a9c";
+
+class NullLogger : public Logger {
+protected:
+	virtual void log(const Logger::Level, const char*, va_list) {
+	}
+};
+
+class BodyStream : public RequestIOStream {
+public:
+	explicit BodyStream(const std::string &body) : body_(body), pos_(0)
+	{}
+	virtual int read(char *buf, int size) {
+		int len = std::min(static_cast<std::size_t>(size), body_.size() - pos_);
+		memcpy(buf, body_.data() + pos_, len);
+		pos_ += len;
+		return len;
+	}
+	virtual int write(const char*, int size) {
+		return size;
+	}
+	virtual void write(std::streambuf*) {
+	}
+	virtual void flush() {
+	}
+private:
+	const std::string &body_;
+	std::size_t pos_;
+};
+
+volatile std::size_t sink;
+
+// what every SegmentIterator did when it was created
+void
+copyingToString(const DataBuffer &buffer, std::string &str) {
+	boost::shared_ptr<DataBufferImpl> impl(buffer.impl()->getCopy());
+	str.clear();
+	for (boost::uint64_t pos = buffer.beginIndex(), end = buffer.endIndex(); pos < end; ) {
+		const boost::uint64_t segment_end = std::min(impl->segment(pos).second, end);
+		str.append(impl->chunk(pos).first, segment_end - pos);
+		pos = segment_end;
+	}
+}
+
+void
+run(int fields, int rounds) {
+	std::string body;
+	std::vector<std::pair<boost::uint64_t, boost::uint64_t> > values;
+	for (int i = 0; i < fields; ++i) {
+		body.append("--").append(BOUNDARY).append("\r\n");
+		body.append("Content-Disposition: form-data; name=\"field").append(std::to_string(i)).append("\"\r\n\r\n");
+		const std::string value = "value" + std::to_string(i);
+		values.push_back(std::make_pair(body.size(), body.size() + value.size()));
+		body.append(value).append("\r\n");
+	}
+	body.append("--").append(BOUNDARY).append("--\r\n");
+
+	const std::string length = "HTTP_CONTENT_LENGTH=" + std::to_string(body.size());
+	const std::string type = std::string("CONTENT_TYPE=multipart/form-data; boundary=") + BOUNDARY;
+	char *env[] = { const_cast<char*>("REQUEST_METHOD=POST"), const_cast<char*>(length.c_str()),
+		const_cast<char*>(type.c_str()), NULL };
+
+	NullLogger logger;
+	Request request(&logger, NULL);
+	std::chrono::duration<double> parseTime(0);
+	for (int round = 0; round < rounds; ++round) {
+		BodyStream stream(body);
+		Clock::time_point start = Clock::now();
+		request.attach(&stream, env);
+		parseTime += Clock::now() - start;
+		sink = request.countArgs();
+		request.recycle();
+	}
+
+	DataBuffer buffer = DataBuffer::create(body.data(), body.size());
+	std::string str;
+	std::chrono::duration<double> borrowTime(0), copyTime(0);
+	for (int round = 0; round < rounds; ++round) {
+		Clock::time_point start = Clock::now();
+		for (std::size_t i = 0; i < values.size(); ++i) {
+			DataBuffer(buffer, values[i].first, values[i].second).toString(str);
+			sink = str.size();
+		}
+		Clock::time_point borrowed = Clock::now();
+		for (std::size_t i = 0; i < values.size(); ++i) {
+			copyingToString(DataBuffer(buffer, values[i].first, values[i].second), str);
+			sink = str.size();
+		}
+		copyTime += Clock::now() - borrowed;
+		borrowTime += borrowed - start;
+	}
+
+	const double parts = static_cast<double>(rounds) * fields;
+	printf("%d fields, %zu bytes (millions of fields per second)\n", fields, body.size());
+	printf("  %-28s %8.2f\n", "multipart request", parts / parseTime.count() / 1e6);
+	printf("  %-28s %8.2f\n", "toString, borrowing iterator", parts / borrowTime.count() / 1e6);
+	printf("  %-28s %8.2f\n", "toString, copying iterator", parts / copyTime.count() / 1e6);
+}
+
+} // namespace
+
+int
+main() {
+	run(100, 2000);
+	run(5000, 40);
+	return 0;
+}
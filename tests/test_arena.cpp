@@ -0,0 +1,116 @@
+#include "settings.h"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "fastcgi2/arena.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class ArenaTest : public CppUnit::TestFixture
+{
+public:
+	void testAllocate();
+	void testLarge();
+	void testReset();
+	void testContainers();
+
+private:
+	CPPUNIT_TEST_SUITE(ArenaTest);
+	CPPUNIT_TEST(testAllocate);
+	CPPUNIT_TEST(testLarge);
+	CPPUNIT_TEST(testReset);
+	CPPUNIT_TEST(testContainers);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ArenaTest);
+
+static bool
+aligned(const void *ptr, std::size_t alignment) {
+	return 0 == reinterpret_cast<std::size_t>(ptr) % alignment;
+}
+
+void
+ArenaTest::testAllocate() {
+	Arena arena(1024);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1024), arena.blockSize());
+
+	char *first = static_cast<char*>(arena.allocate(3, 1));
+	char *second = static_cast<char*>(arena.allocate(5, 1));
+	CPPUNIT_ASSERT_EQUAL(first + 3, second);
+
+	void *third = arena.allocate(8, 64);
+	CPPUNIT_ASSERT(aligned(third, 64));
+
+	// filling several blocks keeps the chunks apart
+	std::vector<char*> chunks;
+	for (int i = 0; i < 100; ++i) {
+		char *chunk = static_cast<char*>(arena.allocate(100));
+		CPPUNIT_ASSERT(aligned(chunk, Arena::DEFAULT_ALIGNMENT));
+		memset(chunk, i, 100);
+		chunks.push_back(chunk);
+	}
+	for (int i = 0; i < 100; ++i) {
+		CPPUNIT_ASSERT_EQUAL(static_cast<char>(i), chunks[i][0]);
+		CPPUNIT_ASSERT_EQUAL(static_cast<char>(i), chunks[i][99]);
+	}
+}
+
+void
+ArenaTest::testLarge() {
+	Arena arena(1024);
+	char *small = static_cast<char*>(arena.allocate(16));
+	char *large = static_cast<char*>(arena.allocate(100000));
+	memset(large, 1, 100000);
+
+	// the current block is not given up for a large chunk
+	char *next = static_cast<char*>(arena.allocate(16));
+	CPPUNIT_ASSERT_EQUAL(small + 16, next);
+}
+
+void
+ArenaTest::testReset() {
+	Arena arena(1024);
+	for (int i = 0; i < 50; ++i) {
+		arena.allocate(100);
+	}
+	arena.allocate(100000);
+
+	arena.reset();
+	CPPUNIT_ASSERT(arena.allocate(16) != NULL);
+
+	Arena empty(1024);
+	empty.reset();
+	CPPUNIT_ASSERT(empty.allocate(16) != NULL);
+}
+
+void
+ArenaTest::testContainers() {
+	Arena arena(256);
+	typedef std::map<std::string, int, std::less<std::string>,
+		ArenaAllocator<std::pair<const std::string, int> > > Map;
+
+	ArenaAllocator<int> allocator(&arena);
+	Map map(std::less<std::string>(), allocator);
+	std::vector<int, ArenaAllocator<int> > v(allocator);
+	for (int i = 0; i < 1000; ++i) {
+		map[std::to_string(i)] = i;
+		v.push_back(i);
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1000), map.size());
+	CPPUNIT_ASSERT_EQUAL(500, map["500"]);
+	CPPUNIT_ASSERT_EQUAL(999, v.back());
+	CPPUNIT_ASSERT(map.get_allocator() == v.get_allocator());
+}
+
+} // namespace fastcgi
@@ -0,0 +1,115 @@
+#include "settings.h"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <set>
+#include <string>
+
+#include "details/ci_hash_map.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class CIHashMapTest : public CppUnit::TestFixture
+{
+public:
+	void testHash();
+	void testInsert();
+	void testGrow();
+	void testClear();
+
+private:
+	CPPUNIT_TEST_SUITE(CIHashMapTest);
+	CPPUNIT_TEST(testHash);
+	CPPUNIT_TEST(testInsert);
+	CPPUNIT_TEST(testGrow);
+	CPPUNIT_TEST(testClear);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(CIHashMapTest);
+
+static boost::uint64_t
+hash(const std::string &str) {
+	return ciHash(str.data(), str.size());
+}
+
+void
+CIHashMapTest::testHash() {
+	CPPUNIT_ASSERT_EQUAL(hash("content-type"), hash("Content-Type"));
+	CPPUNIT_ASSERT_EQUAL(hash("X-FORWARDED-FOR-SOMETHING-LONG"), hash("x-forwarded-for-something-long"));
+	CPPUNIT_ASSERT(hash("a") != hash("b"));
+	CPPUNIT_ASSERT(hash("") != hash(std::string(1, '\0')));
+
+	// only ASCII letters are folded
+	CPPUNIT_ASSERT(hash("[") != hash("{"));
+	CPPUNIT_ASSERT(hash("@") != hash("`"));
+	CPPUNIT_ASSERT(hash("\xc1") != hash("\xe1"));
+
+	CPPUNIT_ASSERT(ciEqual("Content-Length", "CONTENT-length", 14));
+	CPPUNIT_ASSERT(!ciEqual("Content-Length", "Content-Lengtx", 14));
+	CPPUNIT_ASSERT(!ciEqual("[", "{", 1));
+}
+
+void
+CIHashMapTest::testInsert() {
+	CIHashMap<std::string> map;
+	CPPUNIT_ASSERT(map.empty());
+	CPPUNIT_ASSERT(map.end() == map.find("Host"));
+	CPPUNIT_ASSERT(map.begin() == map.end());
+
+	map["Content-Type"] = "text/html";
+	CPPUNIT_ASSERT(map.insert(std::make_pair(std::string("Location"), std::string("/"))).second);
+	CPPUNIT_ASSERT(!map.insert(std::make_pair(std::string("content-type"), std::string("text/xml"))).second);
+	map["CONTENT-TYPE"] = "text/plain";
+
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(2), map.size());
+	CIHashMap<std::string>::const_iterator i = map.find("content-type");
+	CPPUNIT_ASSERT(map.end() != i);
+	CPPUNIT_ASSERT_EQUAL(std::string("Content-Type"), i->first);
+	CPPUNIT_ASSERT_EQUAL(std::string("text/plain"), i->second);
+	CPPUNIT_ASSERT_EQUAL(std::string("/"), map.find("LOCATION")->second);
+}
+
+void
+CIHashMapTest::testGrow() {
+	CIHashMap<int> map;
+	for (int i = 0; i < 1000; ++i) {
+		map["X-Header-" + std::to_string(i)] = i;
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1000), map.size());
+	for (int i = 0; i < 1000; ++i) {
+		CIHashMap<int>::iterator it = map.find("x-header-" + std::to_string(i));
+		CPPUNIT_ASSERT(map.end() != it);
+		CPPUNIT_ASSERT_EQUAL(i, it->second);
+	}
+	CPPUNIT_ASSERT(map.end() == map.find("x-header-1000"));
+
+	std::set<int> seen;
+	for (CIHashMap<int>::iterator it = map.begin(), end = map.end(); it != end; ++it) {
+		seen.insert(it->second);
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1000), seen.size());
+}
+
+void
+CIHashMapTest::testClear() {
+	CIHashMap<std::string> map;
+	map["Status"] = "200 OK";
+	map["Expires"] = "0";
+	map.clear();
+	CPPUNIT_ASSERT(map.empty());
+	CPPUNIT_ASSERT(map.begin() == map.end());
+	CPPUNIT_ASSERT(map.end() == map.find("Status"));
+
+	map["status"] = "404 Not Found";
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), map.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("status"), map.begin()->first);
+	CPPUNIT_ASSERT(map.find("Expires") == map.end());
+}
+
+} // namespace fastcgi
@@ -0,0 +1,234 @@
+#include "settings.h"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include <linux/magic.h>
+#include <sys/vfs.h>
+
+#include "fastcgi2/data_buffer.h"
+#include "fastcgi2/util.h"
+#include "details/byte_search.h"
+#include "details/chunked_buffer.h"
+#include "details/mapped_file_buffer.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class DataBufferTest : public CppUnit::TestFixture
+{
+public:
+	void testChunkedSegments();
+	void testChunkedFind();
+	void testChunkedSplitTrim();
+	void testChunkedUrldecode();
+	void testByteSearch();
+	void testEqualsCI();
+	void testStartsEndsWith();
+	void testFileNoSpace();
+
+private:
+	CPPUNIT_TEST_SUITE(DataBufferTest);
+	CPPUNIT_TEST(testChunkedSegments);
+	CPPUNIT_TEST(testChunkedFind);
+	CPPUNIT_TEST(testChunkedSplitTrim);
+	CPPUNIT_TEST(testChunkedUrldecode);
+	CPPUNIT_TEST(testByteSearch);
+	CPPUNIT_TEST(testEqualsCI);
+	CPPUNIT_TEST(testStartsEndsWith);
+	CPPUNIT_TEST(testFileNoSpace);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DataBufferTest);
+
+static const boost::uint64_t BLOCK = ChunkedBuffer::BLOCK_SIZE;
+
+// a chunked buffer filled with dots and with str written at pos
+static DataBuffer
+chunked(boost::uint64_t size, boost::uint64_t pos, const std::string &str) {
+	DataBuffer buffer = DataBuffer::create(new ChunkedBuffer(size));
+	const std::string dots(size, '.');
+	buffer.write(0, dots.c_str(), dots.size());
+	buffer.write(pos, str.c_str(), str.size());
+	return buffer;
+}
+
+void
+DataBufferTest::testChunkedSegments() {
+	DataBuffer buffer = chunked(2 * BLOCK + 10, BLOCK - 2, "abcd");
+
+	boost::uint64_t segments = 0, size = 0;
+	for (DataBuffer::SegmentIterator it = buffer.begin(), end; it != end; ++it) {
+		++segments;
+		size += it->second;
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(3), segments);
+	CPPUNIT_ASSERT_EQUAL(buffer.size(), size);
+
+	char data[4];
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(4), buffer.read(BLOCK - 2, data, 4));
+	CPPUNIT_ASSERT_EQUAL(std::string("abcd"), std::string(data, 4));
+	CPPUNIT_ASSERT_EQUAL('c', buffer.at(BLOCK));
+
+	std::string str;
+	DataBuffer(buffer, BLOCK - 2, BLOCK + 2).toString(str);
+	CPPUNIT_ASSERT_EQUAL(std::string("abcd"), str);
+
+	// growing keeps the data in place
+	buffer.resize(4 * BLOCK);
+	CPPUNIT_ASSERT_EQUAL('d', buffer.at(BLOCK + 1));
+}
+
+void
+DataBufferTest::testChunkedFind() {
+	// the delimiter starts at every position around the end of the first block
+	for (boost::uint64_t pos = BLOCK - 8; pos <= BLOCK; ++pos) {
+		DataBuffer buffer = chunked(2 * BLOCK, pos, "--boundary");
+		DataBuffer head, tail;
+		CPPUNIT_ASSERT(buffer.split("--boundary", head, tail));
+		CPPUNIT_ASSERT_EQUAL(pos, head.size());
+		CPPUNIT_ASSERT_EQUAL(2 * BLOCK - pos - 10, tail.size());
+	}
+
+	DataBuffer buffer = chunked(2 * BLOCK, BLOCK - 3, "--bound");
+	DataBuffer head, tail;
+	CPPUNIT_ASSERT(!buffer.split("--boundary", head, tail));
+	CPPUNIT_ASSERT(buffer.split('d', head, tail));
+	CPPUNIT_ASSERT_EQUAL(BLOCK + 3, head.size());
+
+	// a match may not go past the end of a slice
+	DataBuffer slice(buffer, 0, BLOCK + 2);
+	CPPUNIT_ASSERT(!slice.split("--bound", head, tail));
+}
+
+void
+DataBufferTest::testChunkedSplitTrim() {
+	DataBuffer buffer = DataBuffer::create(new ChunkedBuffer(2 * BLOCK));
+	const std::string spaces(2 * BLOCK, ' ');
+	buffer.write(0, spaces.c_str(), spaces.size());
+	buffer.write(BLOCK - 1, "a=b", 3);
+
+	std::string str;
+	buffer.trim().toString(str);
+	CPPUNIT_ASSERT_EQUAL(std::string("a=b"), str);
+
+	DataBuffer key, value;
+	CPPUNIT_ASSERT(buffer.trim().split('=', key, value));
+	key.toString(str);
+	CPPUNIT_ASSERT_EQUAL(std::string("a"), str);
+	value.toString(str);
+	CPPUNIT_ASSERT_EQUAL(std::string("b"), str);
+	CPPUNIT_ASSERT(value.startsWith("b"));
+}
+
+void
+DataBufferTest::testChunkedUrldecode() {
+	// the escape starts at every position around the end of the first block
+	for (boost::uint64_t pos = BLOCK - 4; pos <= BLOCK; ++pos) {
+		DataBuffer buffer = chunked(2 * BLOCK, pos, "%41+");
+		std::string expected(2 * BLOCK - 2, '.');
+		expected.replace(pos, 2, "A ");
+		CPPUNIT_ASSERT_EQUAL(expected, StringUtils::urldecode(buffer));
+	}
+
+	// a form value split across blocks, a cut escape at its end stays as it is
+	DataBuffer buffer = chunked(2 * BLOCK, 0, "a=");
+	buffer.write(BLOCK - 2, "%41", 3);
+	buffer.write(2 * BLOCK - 2, "%4", 2);
+	std::vector<StringUtils::NamedValue> args;
+	StringUtils::parse(buffer, args);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), args.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("a"), args[0].first);
+	const std::string expected = std::string(BLOCK - 4, '.') + "A" + std::string(BLOCK - 3, '.') + "%4";
+	CPPUNIT_ASSERT_EQUAL(expected, args[0].second);
+}
+
+void
+DataBufferTest::testByteSearch() {
+	// a substring of every length at every offset around the vector widths,
+	// with decoys that share its first and last bytes
+	for (std::size_t len = 1; len <= 40; ++len) {
+		std::string str(len, 'x');
+		str[0] = 'a';
+		str[len - 1] = 'z';
+		const std::string decoy = (len > 2) ? "a" + std::string(len - 2, 'y') + "z" : str;
+		for (std::size_t pos = 0; pos <= 70; ++pos) {
+			std::string text(pos, '.');
+			if (len > 2 && pos >= len) {
+				text.replace(pos - len, len, decoy);
+			}
+			text.append(str).append(11, '.');
+			const char *begin = text.data(), *end = begin + text.size();
+			const char *found = ByteSearch::find(begin, end, str.data(), str.size());
+			CPPUNIT_ASSERT(found == std::search(begin, end, str.begin(), str.end()));
+			CPPUNIT_ASSERT_EQUAL(pos, static_cast<std::size_t>(found - begin));
+
+			// the match may not go past the end of the range
+			end = begin + pos + len - 1;
+			CPPUNIT_ASSERT(end == ByteSearch::find(begin, end, str.data(), str.size()));
+		}
+	}
+	const char text[] = "abc";
+	CPPUNIT_ASSERT(text == ByteSearch::find(text, text + 3, "", 0));
+	CPPUNIT_ASSERT(text + 3 == ByteSearch::find(text, text + 3, "abcd", 4));
+	CPPUNIT_ASSERT(text + 2 == ByteSearch::find(text, text + 3, 'c'));
+	CPPUNIT_ASSERT(text == ByteSearch::find(text, text, 'c'));
+}
+
+void
+DataBufferTest::testEqualsCI() {
+	const std::string lower = "content-type: multipart/form-data; boundary=@[`{";
+	std::string upper = lower;
+	std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+	for (std::size_t len = 0; len <= lower.size(); ++len) {
+		CPPUNIT_ASSERT(ByteSearch::equalsCI(lower.data(), upper.data(), len));
+	}
+
+	// only ASCII letters fold
+	CPPUNIT_ASSERT(!ByteSearch::equalsCI("@", "`", 1));
+	CPPUNIT_ASSERT(!ByteSearch::equalsCI("[", "{", 1));
+	CPPUNIT_ASSERT(!ByteSearch::equalsCI("\xc0", "\xe0", 1));
+	for (std::size_t pos = 0; pos < lower.size(); ++pos) {
+		std::string other = upper;
+		other[pos] = '\x01';
+		CPPUNIT_ASSERT(!ByteSearch::equalsCI(lower.data(), other.data(), lower.size()));
+	}
+}
+
+void
+DataBufferTest::testStartsEndsWith() {
+	DataBuffer buffer = chunked(2 * BLOCK, BLOCK - 4, "Content-Type");
+	DataBuffer slice(buffer, BLOCK - 4, BLOCK + 8);
+	CPPUNIT_ASSERT(slice.startsWith("Content"));
+	CPPUNIT_ASSERT(slice.startsWithCI("CONTENT-T"));
+	CPPUNIT_ASSERT(!slice.startsWith("content"));
+	CPPUNIT_ASSERT(slice.endsWith("nt-Type"));
+	CPPUNIT_ASSERT(slice.endsWithCI("t-type"));
+	CPPUNIT_ASSERT(!slice.endsWith("t-type"));
+	CPPUNIT_ASSERT(slice.startsWith("Content-Type"));
+	CPPUNIT_ASSERT(!slice.startsWith("Content-Type."));
+	CPPUNIT_ASSERT(!slice.endsWithCI(".content-type"));
+	CPPUNIT_ASSERT(DataBuffer().startsWith(""));
+}
+
+void
+DataBufferTest::testFileNoSpace() {
+	// tmpfs refuses at once to allocate more than its size, other file systems
+	// would be filled up first, so the test runs only where /dev/shm is a tmpfs
+	struct statfs fs;
+	if (0 != statfs("/dev/shm", &fs) || TMPFS_MAGIC != fs.f_type || 0 == fs.f_blocks) {
+		return;
+	}
+	const boost::uint64_t size = static_cast<boost::uint64_t>(fs.f_blocks) * fs.f_bsize + BLOCK;
+	CPPUNIT_ASSERT_THROW(MappedFileBuffer("/dev/shm", size), std::runtime_error);
+}
+
+} // namespace fastcgi
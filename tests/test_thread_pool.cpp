@@ -0,0 +1,310 @@
+#include "settings.h"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "details/mpmc_ring.h"
+#include "details/thread_pool.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class ThreadPoolTest : public CppUnit::TestFixture
+{
+public:
+	void testAllTasksHandled();
+	void testQueueLimit();
+	void testBadTasks();
+	void testSpinAndPark();
+	void testElastic();
+	void testPriorities();
+	void testLifo();
+	void testRing();
+
+private:
+	CPPUNIT_TEST_SUITE(ThreadPoolTest);
+	CPPUNIT_TEST(testAllTasksHandled);
+	CPPUNIT_TEST(testQueueLimit);
+	CPPUNIT_TEST(testBadTasks);
+	CPPUNIT_TEST(testSpinAndPark);
+	CPPUNIT_TEST(testElastic);
+	CPPUNIT_TEST(testPriorities);
+	CPPUNIT_TEST(testLifo);
+	CPPUNIT_TEST(testRing);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(ThreadPoolTest);
+
+class TestThreadPool : public ThreadPool<int> {
+public:
+	TestThreadPool(unsigned threadsNumber, unsigned queueLength) :
+		ThreadPool<int>(threadsNumber, queueLength), sum_(0), blocked_(false)
+	{}
+
+	explicit TestThreadPool(const ThreadPoolSettings &settings) :
+		ThreadPool<int>(settings), sum_(0), blocked_(false)
+	{}
+
+	virtual ~TestThreadPool() {
+		release();
+		stop();
+		join();
+	}
+
+	virtual void handleTask(int value) {
+		while (blocked_) {
+			std::this_thread::yield();
+		}
+		if (value < 0) {
+			throw std::runtime_error("bad task");
+		}
+		sum_ += value;
+		std::lock_guard<std::mutex> lock(mutex_);
+		order_.push_back(value);
+	}
+
+	void block() {
+		blocked_ = true;
+	}
+
+	void release() {
+		blocked_ = false;
+	}
+
+	bool waitTasks(uint64_t count) {
+		for (int i = 0; i < 5000; ++i) {
+			ThreadPoolInfo info = getInfo();
+			if (info.goodTasksCounter + info.badTasksCounter >= count) {
+				return true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return false;
+	}
+
+	uint64_t sum() const {
+		return sum_;
+	}
+
+	std::vector<int> order() const {
+		std::lock_guard<std::mutex> lock(mutex_);
+		return order_;
+	}
+
+private:
+	mutable std::mutex mutex_;
+	std::vector<int> order_;
+	std::atomic<uint64_t> sum_;
+	std::atomic<bool> blocked_;
+};
+
+static void
+noop() {
+}
+
+static void
+addTasks(TestThreadPool *pool, int count) {
+	for (int i = 1; i <= count; ++i) {
+		pool->addTask(i);
+	}
+}
+
+void
+ThreadPoolTest::testAllTasksHandled() {
+	TestThreadPool pool(8, 100000);
+	pool.start(noop);
+
+	std::thread producers[4];
+	for (int i = 0; i < 4; ++i) {
+		producers[i] = std::thread(addTasks, &pool, 10000);
+	}
+	for (int i = 0; i < 4; ++i) {
+		producers[i].join();
+	}
+
+	CPPUNIT_ASSERT(pool.waitTasks(40000));
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(4 * 10000 * 10001 / 2), pool.sum());
+
+	ThreadPoolInfo info = pool.getInfo();
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(40000), info.goodTasksCounter);
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(0), info.currentQueue);
+}
+
+void
+ThreadPoolTest::testQueueLimit() {
+	TestThreadPool pool(2, 10);
+	pool.block();
+	pool.start(noop);
+
+	pool.addTask(1);
+	pool.addTask(1);
+	while (pool.getInfo().busyThreadsCounter < 2) {
+		std::this_thread::yield();
+	}
+	for (int i = 0; i < 10; ++i) {
+		pool.addTask(1);
+	}
+	CPPUNIT_ASSERT_THROW(pool.addTask(1), std::runtime_error);
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(10), pool.getInfo().currentQueue);
+
+	pool.release();
+	CPPUNIT_ASSERT(pool.waitTasks(12));
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(12), pool.sum());
+}
+
+void
+ThreadPoolTest::testBadTasks() {
+	TestThreadPool pool(3, 100);
+	pool.start(noop);
+
+	for (int i = 0; i < 10; ++i) {
+		pool.addTask(i % 2 ? -1 : 1);
+	}
+
+	CPPUNIT_ASSERT(pool.waitTasks(10));
+	ThreadPoolInfo info = pool.getInfo();
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(5), info.goodTasksCounter);
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(5), info.badTasksCounter);
+}
+
+void
+ThreadPoolTest::testSpinAndPark() {
+	ThreadPoolSettings settings;
+	settings.threadsNumber = 4;
+	settings.queueLength = 100;
+	settings.spinTime = 50;
+	TestThreadPool pool(settings);
+	pool.start(noop);
+
+	// let the workers spin out and park between the bursts
+	uint64_t count = 0;
+	for (int burst = 0; burst < 20; ++burst) {
+		for (int i = 0; i < 3; ++i) {
+			pool.addTask(1);
+		}
+		count += 3;
+		CPPUNIT_ASSERT(pool.waitTasks(count));
+		std::this_thread::sleep_for(std::chrono::microseconds(burst % 2 ? 10 : 500));
+	}
+	CPPUNIT_ASSERT_EQUAL(count, pool.sum());
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(0), pool.getInfo().busyThreadsCounter);
+}
+
+void
+ThreadPoolTest::testElastic() {
+	ThreadPoolSettings settings;
+	settings.threadsNumber = 4;
+	settings.minThreadsNumber = 1;
+	settings.idleTimeout = 100;
+	settings.queueLength = 100;
+	TestThreadPool pool(settings);
+	pool.block();
+	pool.start(noop);
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(1), pool.getInfo().threadsNumber);
+
+	for (int i = 0; i < 10; ++i) {
+		pool.addTask(1);
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(4), pool.getInfo().threadsNumber);
+	while (pool.getInfo().busyThreadsCounter < 4) {
+		std::this_thread::yield();
+	}
+
+	pool.release();
+	CPPUNIT_ASSERT(pool.waitTasks(10));
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(10), pool.sum());
+
+	for (int i = 0; i < 5000 && pool.getInfo().threadsNumber > 1; ++i) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(1), pool.getInfo().threadsNumber);
+
+	pool.addTask(1);
+	CPPUNIT_ASSERT(pool.waitTasks(11));
+}
+
+static TestThreadPool*
+busySingleThreadPool(ThreadPoolSettings &settings) {
+	settings.threadsNumber = 1;
+	settings.queueLength = 100;
+	TestThreadPool *pool = new TestThreadPool(settings);
+	pool->block();
+	pool->start(noop);
+	pool->addTask(100);
+	while (pool->getInfo().busyThreadsCounter < 1) {
+		std::this_thread::yield();
+	}
+	return pool;
+}
+
+void
+ThreadPoolTest::testPriorities() {
+	ThreadPoolSettings settings;
+	settings.priorities = 3;
+	std::unique_ptr<TestThreadPool> pool(busySingleThreadPool(settings));
+
+	pool->addTask(3, 2);
+	pool->addTask(1, 0);
+	pool->addTask(2, 1);
+	pool->addTask(4, 7);
+	pool->addTask(5, 0);
+
+	pool->release();
+	CPPUNIT_ASSERT(pool->waitTasks(6));
+	const int expected[] = { 100, 1, 5, 2, 3, 4 };
+	CPPUNIT_ASSERT(std::vector<int>(expected, expected + 6) == pool->order());
+}
+
+void
+ThreadPoolTest::testLifo() {
+	ThreadPoolSettings settings;
+	settings.lifoThreshold = 2;
+	std::unique_ptr<TestThreadPool> pool(busySingleThreadPool(settings));
+
+	for (int i = 1; i <= 5; ++i) {
+		pool->addTask(i);
+	}
+
+	pool->release();
+	CPPUNIT_ASSERT(pool->waitTasks(6));
+	const int expected[] = { 100, 5, 4, 3, 1, 2 };
+	CPPUNIT_ASSERT(std::vector<int>(expected, expected + 6) == pool->order());
+}
+
+void
+ThreadPoolTest::testRing() {
+	MpmcRing<std::string> ring(3);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(4), ring.capacity());
+
+	for (int i = 0; i < 4; ++i) {
+		CPPUNIT_ASSERT(ring.push(boost::lexical_cast<std::string>(i)));
+	}
+	std::string value("rejected");
+	CPPUNIT_ASSERT(!ring.push(std::move(value)));
+	CPPUNIT_ASSERT_EQUAL(std::string("rejected"), value);
+
+	for (int lap = 0; lap < 3; ++lap) {
+		for (int i = 0; i < 4; ++i) {
+			CPPUNIT_ASSERT(ring.pop(value));
+			CPPUNIT_ASSERT_EQUAL(boost::lexical_cast<std::string>(i), value);
+			CPPUNIT_ASSERT(ring.push(boost::lexical_cast<std::string>(i)));
+		}
+	}
+	for (int i = 0; i < 4; ++i) {
+		CPPUNIT_ASSERT(ring.pop(value));
+	}
+	CPPUNIT_ASSERT(!ring.pop(value));
+}
+
+} // namespace fastcgi
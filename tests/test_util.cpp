@@ -0,0 +1,101 @@
+#include "settings.h"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "fastcgi2/util.h"
+#include "details/range.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class UtilTest : public CppUnit::TestFixture
+{
+public:
+	void testUrlencode();
+	void testUrldecode();
+	void testRandom();
+
+private:
+	CPPUNIT_TEST_SUITE(UtilTest);
+	CPPUNIT_TEST(testUrlencode);
+	CPPUNIT_TEST(testUrldecode);
+	CPPUNIT_TEST(testRandom);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(UtilTest);
+
+static std::string
+simpleUrlencode(const std::string &str) {
+	static const char HEX_DIGITS[] = "0123456789ABCDEF";
+	std::string result;
+	for (std::string::const_iterator i = str.begin(), end = str.end(); i != end; ++i) {
+		unsigned char c = *i;
+		if (isalnum(c) || (c && strchr("-_.!~*()'", c))) {
+			result.push_back(c);
+		}
+		else {
+			result.push_back('%');
+			result.push_back(HEX_DIGITS[c >> 4]);
+			result.push_back(HEX_DIGITS[c & 0x0F]);
+		}
+	}
+	return result;
+}
+
+void
+UtilTest::testUrlencode() {
+	CPPUNIT_ASSERT_EQUAL(std::string(""), StringUtils::urlencode(std::string("")));
+	CPPUNIT_ASSERT_EQUAL(std::string("a%20b%2Bc%26d%3De"), StringUtils::urlencode(std::string("a b+c&d=e")));
+	CPPUNIT_ASSERT_EQUAL(std::string("-_.!~*()'"), StringUtils::urlencode(std::string("-_.!~*()'")));
+	CPPUNIT_ASSERT_EQUAL(std::string("%D1%8F%00%FF"), StringUtils::urlencode(std::string("\xd1\x8f\0\xff", 4)));
+
+	std::string text = "The quick brown fox jumps over the lazy dog, then [again] & again: 100% {sure}?";
+	CPPUNIT_ASSERT_EQUAL(simpleUrlencode(text), StringUtils::urlencode(text));
+	CPPUNIT_ASSERT_EQUAL(simpleUrlencode(text).size(), StringUtils::urlencodedSize(Range::fromString(text)));
+}
+
+void
+UtilTest::testUrldecode() {
+	CPPUNIT_ASSERT_EQUAL(std::string(""), StringUtils::urldecode(std::string("")));
+	CPPUNIT_ASSERT_EQUAL(std::string("a b+c&d"), StringUtils::urldecode(std::string("a+b%2bc%26d")));
+	CPPUNIT_ASSERT_EQUAL(std::string("\xd1\x8f"), StringUtils::urldecode(std::string("%D1%8f")));
+
+	// an escape cut by the end stays as is
+	CPPUNIT_ASSERT_EQUAL(std::string("abc%4"), StringUtils::urldecode(std::string("abc%4")));
+	CPPUNIT_ASSERT_EQUAL(std::string("abc%"), StringUtils::urldecode(std::string("abc%")));
+
+	std::string padding(45, 'x');
+	CPPUNIT_ASSERT_EQUAL(padding + " / " + padding, StringUtils::urldecode(padding + "+%2F+" + padding));
+
+	// decoding in place
+	std::string str = padding + "%41" + padding + "+";
+	char *end = StringUtils::urldecode(Range::fromString(str), &str[0]);
+	CPPUNIT_ASSERT_EQUAL(padding + "A" + padding + " ", std::string(&str[0], end));
+}
+
+void
+UtilTest::testRandom() {
+	srand(7);
+	for (int round = 0; round < 200; ++round) {
+		std::string str;
+		for (int i = 0, size = rand() % 100; i < size; ++i) {
+			// mostly letters, as in a typical form
+			str.push_back((rand() % 4) ? 'a' + rand() % 26 : static_cast<char>(rand() % 256));
+		}
+		std::string encoded = StringUtils::urlencode(str);
+		CPPUNIT_ASSERT_EQUAL(simpleUrlencode(str), encoded);
+		CPPUNIT_ASSERT_EQUAL(str, StringUtils::urldecode(encoded));
+	}
+}
+
+} // namespace fastcgi